@@ -2,6 +2,7 @@
 #include <utility>
 #include <iostream>
 #include <optional>
+#include <algorithm>
 
 #include <libunwind.h>
 #include <libunwind-ptrace.h>
@@ -15,174 +16,214 @@
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 
 #include "backtrace.hpp"
+#include "vm_accessors.hpp"
+#include "fast_sample.hpp"
 
 using std::optional;
 using std::string;
 using std::to_string;
 using std::move;
 
-static Result<optional<ThreadSample>, string> fail(std::string&& message) {
-    return Result<optional<ThreadSample>, string>::fail(move(message));
-}
-
-class PtraceDetachGuard {
-    pid_t pid;
-public:
-    int stopped_signal = 0;
-    PtraceDetachGuard(pid_t pid): pid(pid) {}
-    PtraceDetachGuard(const PtraceDetachGuard&) = delete;
-    ~PtraceDetachGuard() {
-        if (pid) {
-            int rc = ptrace(PTRACE_DETACH, pid, 0, stopped_signal);
-            if (rc != 0) {
-                std::cerr << ("ptrace(PTRACE_DETACH) failed with errno = " + to_string(errno) + " message = " + strerror(errno)) << "\n";
-            }
-            pid = 0;
-        }
-    }
-};
-
-class UnwAddrSpaceGuard {
-    unw_addr_space_t data;
-public:
-    UnwAddrSpaceGuard(unw_addr_space_t data): data(data) {}
-    UnwAddrSpaceGuard(const UnwAddrSpaceGuard&) = delete;
-    ~UnwAddrSpaceGuard() {
-        if (data) {
-            unw_destroy_addr_space(data);
-            data = nullptr;
-        }
-    }
-};
-
-class UptInfoGuard {
-    struct UPT_info* data;
-public:
-    UptInfoGuard(struct UPT_info* data): data(data) {}
-    UptInfoGuard(const UptInfoGuard&) = delete;
-    ~UptInfoGuard() {
-        if (data) {
-            _UPT_destroy(data);
-            data = nullptr;
-        }
+ThreadStop::ThreadStop(pid_t tid) : tid_(tid) {}
+
+ThreadStop::ThreadStop(ThreadStop&& other)
+    : interrupted_at(other.interrupted_at), released_at(other.released_at),
+      tid_(other.tid_), seized_(other.seized_), stopped_signal(other.stopped_signal) {
+    other.seized_ = false;
+}
+
+ThreadStop& ThreadStop::operator=(ThreadStop&& other) {
+    if (this != &other) {
+        release();
+        interrupted_at = other.interrupted_at;
+        released_at = other.released_at;
+        tid_ = other.tid_;
+        seized_ = other.seized_;
+        stopped_signal = other.stopped_signal;
+        other.seized_ = false;
     }
-};
+    return *this;
+}
 
-Result<optional<ThreadSample>, string> sample_thread(StringPool& string_pool, PerfSymbolMap& symbol_map, uintptr_t tid_) {
-    pid_t target_pid = tid_;
-    int rc;
+ThreadStop::~ThreadStop() {
+    release();
+}
 
-    rc = ptrace(PTRACE_SEIZE, target_pid, 0, 0);
+Result<bool, string> ThreadStop::interrupt() {
+    int rc = ptrace(PTRACE_SEIZE, tid_, 0, 0);
     if (rc != 0) {
         if (errno == ESRCH) {
             // LWP does not exist
-            return Result<optional<ThreadSample>, string>::success(std::nullopt);
+            return ResultInit::ok(false);
         }
 
-        return fail("ptrace(PTRACE_SEIZE) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
+        return ResultInit::err("ptrace(PTRACE_SEIZE) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
     }
 
-    PtraceDetachGuard ptrace_detach_guard(target_pid);
+    seized_ = true;
+    interrupted_at = std::chrono::steady_clock::now();
 
-    rc = ptrace(PTRACE_INTERRUPT, target_pid, 0, 0);
+    rc = ptrace(PTRACE_INTERRUPT, tid_, 0, 0);
     if (rc != 0) {
-        return fail("ptrace(PTRACE_INTERRUPT) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
+        return ResultInit::err("ptrace(PTRACE_INTERRUPT) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
     }
 
-    int signal_delivery_stop_signal = 0;
+    return ResultInit::ok(true);
+}
 
-    {
-        int status;
-        pid_t tmp = waitpid(target_pid, &status, WCONTINUED | __WALL);
-        if (tmp != target_pid) {
-            return fail("waitpid() failed with ret = " + to_string(tmp) + " errno = " + to_string(errno) + " message = " + strerror(errno));
-        }
+Result<bool, string> ThreadStop::wait() {
+    int status;
+    pid_t tmp = waitpid(tid_, &status, WCONTINUED | __WALL);
+    if (tmp != tid_) {
+        return ResultInit::err("waitpid() failed with ret = " + to_string(tmp) + " errno = " + to_string(errno) + " message = " + strerror(errno));
+    }
 
-        if (!WIFSTOPPED(status)) {
-            return fail("waitpid() returned bad status: !WIFSTOPPED(status); status = " + to_string(status));
-        }
+    if (!WIFSTOPPED(status)) {
+        return ResultInit::err("waitpid() returned bad status: !WIFSTOPPED(status); status = " + to_string(status));
+    }
 
-        if (WSTOPSIG(status)) {
-            // Process stopped via signal delivery
-            signal_delivery_stop_signal = WSTOPSIG(status);
-            ptrace_detach_guard.stopped_signal = signal_delivery_stop_signal;
-        }
+    if (WSTOPSIG(status)) {
+        // Process stopped via signal delivery
+        stopped_signal = WSTOPSIG(status);
     }
 
-    double timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() * 0.001;
+    return ResultInit::ok(true);
+}
 
-    uint64_t thread_name_id;
-    {
-        string path = string("/proc/") + to_string(target_pid) + "/comm";
-        std::ifstream stream(path.c_str());
-        string thread_name;
-        getline(stream, thread_name);
-        for (auto& c: thread_name) {
-            if (c == ' ') {
-                c = '_';
-            }
+void ThreadStop::release() {
+    if (seized_) {
+        int rc = ptrace(PTRACE_DETACH, tid_, 0, stopped_signal);
+        if (rc != 0) {
+            std::cerr << ("ptrace(PTRACE_DETACH) failed with errno = " + to_string(errno) + " message = " + strerror(errno)) << "\n";
         }
-        thread_name_id = string_pool.intern(thread_name);
+        released_at = std::chrono::steady_clock::now();
+        seized_ = false;
+    }
+}
+
+static bool resolve_jit_symbol(PerfSymbolMap& symbol_map, StackFrame& frame) {
+    auto symbol = symbol_map.resolve(frame.ip);
+    if (symbol.has_value()) {
+        frame.name_id = symbol->name_id;
+        frame.name_offset = frame.ip - symbol->offset;
+        frame.module_id = symbol_map.path_id;
+        return true;
     }
+    return false;
+}
+
+// Looks the frame up in the ELF files mapped into the process, without
+// touching the process itself.
+static bool resolve_elf_symbol(const ElfSymbolizer& symbolizer, StackFrame& frame, bool leaf) {
+    frame.module_id = symbolizer.module_name(frame.ip);
 
-    unw_addr_space_t address_space = unw_create_addr_space (&_UPT_accessors, 0);
-    if (address_space == nullptr) {
-        return fail("unw_create_addr_space() failed");
+    // Return addresses may point just past the end of a function
+    // ending with a call, so look up the call instruction instead.
+    uintptr_t lookup_ip = leaf ? frame.ip : frame.ip - 1;
+    uintptr_t offset;
+    if (symbolizer.resolve(lookup_ip, frame.name_id, offset)) {
+        frame.name_offset = offset + (frame.ip - lookup_ip);
+        return true;
     }
-    UnwAddrSpaceGuard address_space_guard(address_space);
+    return false;
+}
 
-    struct UPT_info* unw_ptrace_cb = (struct UPT_info*) _UPT_create (target_pid);
-    if (unw_ptrace_cb == nullptr) {
-        return fail("_UPT_create() failed");
+// Fills the frame name and module from context.symbol_cache, or by calling
+// `lookup(frame)` on a miss.
+template <typename Lookup>
+static void resolve_frame(SamplerContext& context, SymbolCache::Stats& stats, StackFrame& frame, bool leaf, Lookup&& lookup) {
+    auto started_at = std::chrono::steady_clock::now();
+    SymbolCache::Symbol symbol;
+    if (context.symbol_cache.lookup(frame.ip, leaf, symbol)) {
+        ++stats.hits;
+        frame.name_id = symbol.name_id;
+        frame.name_offset = symbol.name_offset;
+        frame.module_id = symbol.module_id;
+    } else {
+        ++stats.misses;
+        lookup(frame);
+        symbol = SymbolCache::Symbol { frame.name_id, frame.name_offset, frame.module_id };
+        context.symbol_cache.insert(frame.ip, leaf, symbol);
     }
-    UptInfoGuard unw_ptrace_cb_guard (unw_ptrace_cb);
 
+    stats.resolve_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_at).count();
+}
+
+// Resolves a frame without a libunwind cursor: perf map, local ELF symbols,
+// then a remote lookup in the target.
+static void resolve_stack_frame(SamplerContext& context, SymbolCache::Stats& stats, VmUnwindContext& unwind_context, StackFrame& frame, bool leaf) {
+    resolve_frame(context, stats, frame, leaf, [&](StackFrame& frame) {
+        if (resolve_jit_symbol(context.symbol_map, frame) || resolve_elf_symbol(context.elf_symbolizer, frame, leaf)) {
+            return;
+        }
+
+        // Not in the local symbol tables (e.g. no file to read), ask the target.
+        unw_word_t lookup_ip = leaf ? frame.ip : frame.ip - 1;
+        unw_word_t ip_offset;
+        char buf[1024];
+
+        int rc = vm_accessors.get_proc_name(context.unwind_registry.address_space(), lookup_ip, &buf[0], sizeof(buf), &ip_offset, &unwind_context);
+        if (rc == 0 || rc == -UNW_ENOMEM) {
+            frame.name_id = context.string_pool.intern(std::string_view(buf));
+            frame.name_offset = ip_offset + (frame.ip - lookup_ip);
+        }
+    });
+}
+
+static Result<bool, string> unwind_with_libunwind(SamplerContext& context, SymbolCache::Stats& stats, VmUnwindContext& unwind_context, ThreadSample& thread_sample) {
     unw_cursor_t cursor;
-    rc = unw_init_remote (&cursor, address_space, unw_ptrace_cb);
+    int rc = unw_init_remote (&cursor, context.unwind_registry.address_space(), &unwind_context);
     if (rc < 0) {
-        return fail("unw_init_remote() failed with ret = " + to_string(rc));
+        return ResultInit::err("unw_init_remote() failed with ret = " + to_string(rc));
     }
-    
-    ThreadSample thread_sample;
-    thread_sample.tid = target_pid;
-    thread_sample.timestamp = timestamp;
-    thread_sample.thread_name_id = thread_name_id;
-    
+
+    StackSuffixCache& stack_cache = unwind_context.stack_cache;
+    stack_cache.begin();
+    std::vector<uintptr_t>& spliced_ips = unwind_context.ips;
+    spliced_ips.clear();
     while (true) {
         unw_word_t ip, sp;
         rc = unw_get_reg(&cursor, UNW_REG_IP, &ip);
         if (rc < 0) {
-            return fail("unw_get_reg(UNG_REG_IP) failed with ret = " + to_string(rc));
+            return ResultInit::err("unw_get_reg(UNG_REG_IP) failed with ret = " + to_string(rc));
         }
-
         rc = unw_get_reg(&cursor, UNW_REG_SP, &sp);
         if (rc < 0) {
-            return fail("unw_get_reg(UNG_REG_SP) failed with ret = " + to_string(rc));
+            return ResultInit::err("unw_get_reg(UNG_REG_SP) failed with ret = " + to_string(rc));
         }
 
-        uint64_t name_id = StackFrame::NO_NAME;
-        uintptr_t name_offset = 0;
-
-        {
-            unw_word_t ip_offset;
-            char buf[1024];
-
-            rc = unw_get_proc_name(&cursor, &buf[0], sizeof(buf), &ip_offset);
-            if (rc == 0 || rc == UNW_ENOMEM) {
-                name_id = string_pool.intern(std::string_view(buf));
-                name_offset = ip_offset;
-            } else {
-                auto symbol = symbol_map.resolve(ip);
-                if (symbol.has_value()) {
-                    name_id = symbol->name_id;
-                    name_offset = symbol->offset + symbol->length - ip;
+        if (!thread_sample.frames.empty() && stack_cache.splice(unwind_context.memory, ip, sp, spliced_ips)) {
+            break;
+        }
+        stack_cache.push(ip, sp);
+
+        StackFrame frame { ip, StackFrame::NO_NAME, 0 };
+
+        bool leaf = thread_sample.frames.empty();
+        if (!context.defer_symbols) {
+            resolve_frame(context, stats, frame, leaf, [&](StackFrame& frame) {
+                if (resolve_elf_symbol(context.elf_symbolizer, frame, leaf)) {
+                    return;
                 }
-            }
+
+                // Not in the local symbol tables (e.g. no file to read), ask the target.
+                unw_word_t ip_offset;
+                char buf[1024];
+
+                int rc = unw_get_proc_name(&cursor, &buf[0], sizeof(buf), &ip_offset);
+                if (rc == 0 || rc == -UNW_ENOMEM) {
+                    frame.name_id = context.string_pool.intern(std::string_view(buf));
+                    frame.name_offset = ip_offset;
+                    return;
+                }
+                resolve_jit_symbol(context.symbol_map, frame);
+            });
         }
 
-        thread_sample.frames.push_back(StackFrame { ip, name_id, name_offset });
+        thread_sample.frames.push_back(frame);
 
         rc = unw_step(&cursor);
         if (rc == 0) {
@@ -191,9 +232,242 @@ Result<optional<ThreadSample>, string> sample_thread(StringPool& string_pool, Pe
         }
 
         if (rc < 0) {
-            return fail("unw_step() failed with ret = " + to_string(rc));
+            return ResultInit::err("unw_step() failed with ret = " + to_string(rc));
+        }
+    }
+
+    for (uintptr_t ip: spliced_ips) {
+        StackFrame frame { ip, StackFrame::NO_NAME, 0 };
+        if (!context.defer_symbols) {
+            resolve_stack_frame(context, stats, unwind_context, frame, false);
+        }
+        thread_sample.frames.push_back(frame);
+    }
+    stack_cache.commit();
+
+    return ResultInit::ok(true);
+}
+
+static Result<bool, string> unwind_with_frame_pointers(SamplerContext& context, SymbolCache::Stats& stats, VmUnwindContext& unwind_context, ThreadSample& thread_sample) {
+    std::vector<uintptr_t>& ips = unwind_context.ips;
+    ips.clear();
+    auto unwind_result = fast_unwind(unwind_context, context.unwind_registry.address_space(), context.symbol_map, ips);
+    if (!unwind_result.isOk()) {
+        return unwind_result;
+    }
+
+    thread_sample.frames.reserve(ips.size());
+    for (size_t i = 0; i < ips.size(); ++i) {
+        StackFrame frame { ips[i], StackFrame::NO_NAME, 0 };
+        if (!context.defer_symbols) {
+            resolve_stack_frame(context, stats, unwind_context, frame, i == 0);
+        }
+        thread_sample.frames.push_back(frame);
+    }
+
+    return ResultInit::ok(true);
+}
+
+// Mono stops threads for the GC by signalling them; the handler then waits in sigsuspend().
+static bool is_gc_suspended(StringPool& string_pool, const ThreadSample& thread_sample) {
+    if (thread_sample.state.syscall == SYS_rt_sigsuspend) {
+        return true;
+    }
+
+    if (thread_sample.frames.empty() || thread_sample.frames[0].name_id == StackFrame::NO_NAME) {
+        return false;
+    }
+    return string_pool.get_by_id(thread_sample.frames[0].name_id).find("sigsuspend") != std::string_view::npos;
+}
+
+// Unwinds a thread whose registers were loaded into `unwind_context`.
+static Result<bool, string> unwind_loaded_thread(SamplerContext& context, VmUnwindContext& unwind_context, ThreadSample& thread_sample) {
+    SymbolCache::Stats symbol_stats;
+    auto unwind_started_at = std::chrono::steady_clock::now();
+    auto unwind_result = context.unwinder == Unwinder::FramePointer
+        ? unwind_with_frame_pointers(context, symbol_stats, unwind_context, thread_sample)
+        : unwind_with_libunwind(context, symbol_stats, unwind_context, thread_sample);
+    uint64_t unwind_nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - unwind_started_at).count();
+    context.symbol_cache.add_stats(symbol_stats);
+    // Name lookups are interleaved with the walk; report them separately.
+    context.phase_stats.record(Phase::Unwind, unwind_nanoseconds - std::min(unwind_nanoseconds, symbol_stats.resolve_nanoseconds));
+    if (!context.defer_symbols) {
+        context.phase_stats.record(Phase::Symbolize, symbol_stats.resolve_nanoseconds);
+    }
+    if (!unwind_result.isOk()) {
+        return ResultInit::err(move(unwind_result).getErrRef());
+    }
+
+    if (!context.defer_symbols) {
+        thread_sample.state.gc_suspended = is_gc_suspended(context.string_pool, thread_sample);
+    }
+
+    return ResultInit::ok(true);
+}
+
+static double now_seconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() * 0.001;
+}
+
+Result<bool, string> sample_stopped_thread(SamplerContext& context, const ThreadStop& stop, const ThreadState& state, ThreadSample& thread_sample) {
+    pid_t target_pid = stop.tid();
+
+    double timestamp = now_seconds();
+
+    PhaseTimer read_name_timer(context.phase_stats, Phase::ReadName);
+    uint64_t thread_name_id = context.thread_files.read_name(target_pid, context.string_pool);
+    read_name_timer.stop();
+
+    PhaseTimer get_registers_timer(context.phase_stats, Phase::GetRegisters);
+    VmUnwindContext* unwind_context = context.unwind_registry.context(target_pid);
+    if (unwind_context == nullptr) {
+        return ResultInit::err(string("_UPT_create() failed"));
+    }
+
+    auto load_result = unwind_context->load_registers();
+    get_registers_timer.stop();
+    if (!load_result.isOk()) {
+        return ResultInit::err(string(load_result.getErrRef()));
+    }
+
+    thread_sample.tid = target_pid;
+    thread_sample.timestamp = timestamp;
+    thread_sample.thread_name_id = thread_name_id;
+    thread_sample.state = state;
+    // Same value /proc/<tid>/syscall would report, without another read.
+    thread_sample.state.syscall = (int64_t) unwind_context->regs.orig_rax;
+    thread_sample.frames.clear();
+
+    auto unwind_result = unwind_loaded_thread(context, *unwind_context, thread_sample);
+    if (!unwind_result.isOk()) {
+        return unwind_result;
+    }
+
+    context.idle_threads.remember(thread_sample);
+    return ResultInit::ok(true);
+}
+
+bool reuse_idle_sample(SamplerContext& context, pid_t tid, const ThreadState& state, ThreadSample& thread_sample) {
+    SchedStat schedstat;
+    if (!context.thread_files.read_schedstat(tid, schedstat)) {
+        return false;
+    }
+
+    if (!context.idle_threads.reuse(tid, state, schedstat, thread_sample)) {
+        return false;
+    }
+    thread_sample.timestamp = now_seconds();
+    return true;
+}
+
+Result<bool, string> sample_captured_stack(SamplerContext& context, const CapturedStack& captured, ThreadSample& thread_sample) {
+    PhaseTimer read_name_timer(context.phase_stats, Phase::ReadName);
+    uint64_t thread_name_id = context.thread_files.read_name(captured.tid, context.string_pool);
+    read_name_timer.stop();
+
+    VmUnwindContext* unwind_context = context.unwind_registry.context(captured.tid);
+    if (unwind_context == nullptr) {
+        return ResultInit::err(string("_UPT_create() failed"));
+    }
+
+    // Everything in the stack mapping outside of the captured bytes has
+    // changed since the sample was taken.
+    uintptr_t region_start = captured.sp;
+    uintptr_t region_end = captured.sp + captured.stack_size;
+    const MemoryMapping* stack_mapping = find_mapping(context.unwind_registry.maps().mappings(), captured.sp);
+    if (stack_mapping != nullptr) {
+        region_start = stack_mapping->start;
+        region_end = stack_mapping->end;
+    }
+    unwind_context->load_captured_registers(captured.ip, captured.sp, captured.bp);
+    unwind_context->memory.set_stack_snapshot(captured.sp, captured.stack, captured.stack_size, region_start, region_end);
+
+    thread_sample.tid = captured.tid;
+    thread_sample.timestamp = captured.time_ns * 1e-9;
+    thread_sample.thread_name_id = thread_name_id;
+    // cpu-clock only fires while the thread is on a CPU in user mode.
+    thread_sample.state = ThreadState();
+    thread_sample.state.run_state = 'R';
+    thread_sample.frames.clear();
+
+    auto unwind_result = unwind_loaded_thread(context, *unwind_context, thread_sample);
+    // The captured bytes belong to the ring buffer, which is reused after the drain.
+    unwind_context->memory.reset();
+    return unwind_result;
+}
+
+void symbolize_samples(SamplerContext& context, std::vector<ThreadSample>& thread_samples) {
+    PhaseTimer timer(context.phase_stats, Phase::Symbolize);
+
+    // Leaf frames are looked up by their own IP, the rest by ip - 1; see SymbolCache.
+    auto key = [](const StackFrame& frame, bool leaf) {
+        return (frame.ip << 1) | (leaf ? 1 : 0);
+    };
+
+    std::vector<uintptr_t>& keys = context.buffers.symbol_keys;
+    keys.clear();
+    for (const auto& thread_sample: thread_samples) {
+        for (size_t i = 0; i < thread_sample.frames.size(); ++i) {
+            keys.push_back(key(thread_sample.frames[i], i == 0));
         }
     }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    // Only local lookups here: the threads are running again, so the
+    // remote ones (which need a stopped thread) are not available.
+    SymbolCache::Stats stats;
+    std::vector<StackFrame>& resolved = context.buffers.resolved_frames;
+    resolved.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        bool leaf = (keys[i] & 1) != 0;
+        resolved[i] = StackFrame { keys[i] >> 1, StackFrame::NO_NAME, 0 };
+        resolve_frame(context, stats, resolved[i], leaf, [&](StackFrame& frame) {
+            if (!resolve_jit_symbol(context.symbol_map, frame)) {
+                resolve_elf_symbol(context.elf_symbolizer, frame, leaf);
+            }
+        });
+    }
+    context.symbol_cache.add_stats(stats);
 
-    return Result<optional<ThreadSample>, string>::success(move(thread_sample));
+    for (auto& thread_sample: thread_samples) {
+        for (size_t i = 0; i < thread_sample.frames.size(); ++i) {
+            auto it = std::lower_bound(keys.begin(), keys.end(), key(thread_sample.frames[i], i == 0));
+            thread_sample.frames[i] = resolved[it - keys.begin()];
+        }
+        thread_sample.state.gc_suspended = is_gc_suspended(context.string_pool, thread_sample);
+    }
+}
+
+Result<bool, string> sample_thread(SamplerContext& context, ThreadStop& stop, ThreadSample& thread_sample) {
+    ThreadState state;
+    {
+        PhaseTimer timer(context.phase_stats, Phase::ReadState);
+        context.thread_files.read_state(stop.tid(), context.string_pool, state);
+    }
+
+    if (reuse_idle_sample(context, stop.tid(), state, thread_sample)) {
+        return ResultInit::ok(true);
+    }
+
+    PhaseTimer interrupt_timer(context.phase_stats, Phase::Interrupt);
+    auto interrupt_result = stop.interrupt();
+    interrupt_timer.stop();
+    if (!interrupt_result.isOk() || !interrupt_result.getOkRef()) {
+        return interrupt_result;
+    }
+
+    PhaseTimer wait_timer(context.phase_stats, Phase::Wait);
+    auto wait_result = stop.wait();
+    wait_timer.stop();
+    if (!wait_result.isOk()) {
+        return wait_result;
+    }
+
+    auto sample_result = sample_stopped_thread(context, stop, state, thread_sample);
+    {
+        PhaseTimer timer(context.phase_stats, Phase::Release);
+        stop.release();
+    }
+    return sample_result;
 }
@@ -5,10 +5,22 @@
 #include <string>
 #include <mutex>
 #include <memory>
+#include <chrono>
+#include <optional>
+
+#include <sys/types.h>
 
 #include "result.hpp"
 #include "stringpool.hpp"
 #include "perf_symbol_map.hpp"
+#include "unwind_registry.hpp"
+#include "worker_pool.hpp"
+#include "thread_state.hpp"
+#include "symbol_cache.hpp"
+#include "elf_symbols.hpp"
+#include "phase_stats.hpp"
+#include "perf_sampler.hpp"
+#include "idle_threads.hpp"
 
 struct StackFrame {
     static const uint64_t NO_NAME = (uint64_t) -1;
@@ -16,19 +28,181 @@ struct StackFrame {
     uintptr_t ip;
     uint64_t name_id;
     uintptr_t name_offset;
+    // Interned path of the mapped file (or the perf map for JIT code).
+    uint64_t module_id = NO_NAME;
 };
 
 struct ThreadSample {
     uintptr_t tid;
     double timestamp;
     uint64_t thread_name_id;
+    ThreadState state;
     std::vector<StackFrame> frames;
 };
 
+// How stacks are collected.
+enum class Engine {
+    // Stop every thread with ptrace on each tick, see sample_process().
+    Ptrace,
+    // Let the kernel copy user stacks on cpu-clock ticks, see sample_perf_events().
+    Perf,
+};
+
+enum class Unwinder {
+    Libunwind,
+    // see fast_unwind()
+    FramePointer,
+};
+
+// Cost of taking one ProcessSample, reported with --debug.
+struct SampleStats {
+    // Wall time of sample_process().
+    double duration_seconds = 0;
+    // Sum over threads of the time each of them was held in ptrace-stop.
+    double total_stop_seconds = 0;
+    // From the first interrupt to the last release in this sample.
+    double stop_window_seconds = 0;
+    // Session totals at the time of the sample, see UnwindRegistry.
+    uint64_t proc_info_lookups = 0;
+    uint64_t cache_flushes = 0;
+    uint64_t spliced_frames = 0;
+    // Session total of blocked threads that were not stopped, see IdleThreadCache.
+    uint64_t idle_threads_reused = 0;
+    // Session total of /proc/<pid>/task reads, see ThreadLister.
+    uint64_t thread_list_rescans = 0;
+    // Session totals of SymbolCache, see SymbolCache::Stats.
+    uint64_t symbol_cache_hits = 0;
+    uint64_t symbol_cache_misses = 0;
+    uint64_t symbol_resolve_nanoseconds = 0;
+    // Session totals of PerfEventSampler (--engine=perf).
+    uint64_t perf_samples = 0;
+    uint64_t perf_lost_samples = 0;
+};
+
 struct ProcessSample {
     uintptr_t pid;
+    // Interned "comm (pid)", set when several processes are profiled at once.
+    uint64_t process_tag_id = StackFrame::NO_NAME;
     std::vector<ThreadSample> threads;
+    SampleStats stats;
 };
 
-Result<std::optional<ThreadSample>, std::string> sample_thread(StringPool& string_pool, PerfSymbolMap& symbol_map, uintptr_t tid);
-Result<ProcessSample, std::string> sample_process(StringPool& string_pool, PerfSymbolMap& symbol_map, uintptr_t pid, std::optional<uintptr_t> tid);
+// A thread held in ptrace-stop by the calling thread. It is resumed by
+// release() or on destruction, which must happen on the same (tracer) thread.
+class ThreadStop {
+public:
+    std::chrono::steady_clock::time_point interrupted_at;
+    std::chrono::steady_clock::time_point released_at;
+
+    explicit ThreadStop(pid_t tid = 0);
+    ThreadStop(const ThreadStop&) = delete;
+    ThreadStop(ThreadStop&& other);
+    ThreadStop& operator=(ThreadStop&& other);
+    ~ThreadStop();
+
+    // PTRACE_SEIZE + PTRACE_INTERRUPT. Returns false if the thread is gone.
+    Result<bool, std::string> interrupt();
+    // Waits for the stop requested by interrupt().
+    Result<bool, std::string> wait();
+    void release();
+
+    pid_t tid() const { return tid_; }
+    bool seized() const { return seized_; }
+    bool was_stopped() const { return released_at > interrupted_at; }
+
+private:
+    pid_t tid_;
+    bool seized_ = false;
+    int stopped_signal = 0;
+};
+
+// State shared by all processes of one profiling session.
+struct SamplingSession {
+    StringPool& string_pool;
+    // Parsed ELF files, shared by processes that map the same libraries.
+    ElfModuleCache elf_modules;
+    PhaseStats phase_stats;
+    WorkerPool workers;
+    Unwinder unwinder;
+    // Stop all threads first, unwind them while frozen, then release them together.
+    bool snapshot;
+    // Only collect IPs while threads are stopped, see symbolize_samples().
+    bool defer_symbols;
+    // If not 0, the i-th of n threads is sampled at tick start + i * spread_ns / n
+    // instead of all of them at once. Not used with `snapshot`.
+    uint64_t spread_ns;
+
+    SamplingSession(StringPool& string_pool, Unwinder unwinder, size_t jobs, bool snapshot, bool defer_symbols, uint64_t spread_ns)
+        : string_pool(string_pool), workers(jobs), unwinder(unwinder), snapshot(snapshot), defer_symbols(defer_symbols), spread_ns(spread_ns) {}
+};
+
+// Scratch space of sample_process(), kept between ticks so that sampling an
+// unchanged set of threads does not allocate.
+struct TickBuffers {
+    // Copy of ThreadLister::tids(), or the single --tid.
+    std::vector<uintptr_t> thread_ids;
+    std::vector<ThreadStop> stops;
+    std::vector<ThreadState> states;
+    // Non-zero for threads whose sample was taken this tick.
+    std::vector<uint8_t> sampled;
+    // First error of each worker.
+    std::vector<std::optional<std::string>> errors;
+    std::vector<MemoryMapping> removed_mappings;
+    // Address ranges of new perf map lines.
+    std::vector<SymbolCache::Range> jit_ranges;
+    // see symbolize_samples()
+    std::vector<uintptr_t> symbol_keys;
+    std::vector<StackFrame> resolved_frames;
+};
+
+// State shared by all samples of one process.
+struct SamplerContext {
+    StringPool& string_pool;
+    PerfSymbolMap& symbol_map;
+    UnwindRegistry unwind_registry;
+    ElfSymbolizer elf_symbolizer;
+    SymbolCache symbol_cache;
+    PhaseStats& phase_stats;
+    ThreadProcFiles thread_files;
+    ThreadLister thread_lister;
+    IdleThreadCache idle_threads;
+    WorkerPool& workers;
+    uintptr_t pid;
+    // Copied from the session, see SamplingSession.
+    Unwinder unwinder;
+    bool snapshot;
+    bool defer_symbols;
+    uint64_t spread_ns;
+    // If not 0, threads are spread from this time on instead of from the
+    // start of sample_process(). Set by ProcessSet, which gives each process
+    // its own slice of the tick.
+    uint64_t spread_start_ns = 0;
+    TickBuffers buffers;
+
+    SamplerContext(SamplingSession& session, PerfSymbolMap& symbol_map, uintptr_t pid)
+        : string_pool(session.string_pool), symbol_map(symbol_map), unwind_registry(pid), elf_symbolizer(session.string_pool, session.elf_modules, pid),
+          phase_stats(session.phase_stats), thread_files(pid), thread_lister(pid), workers(session.workers), pid(pid), unwinder(session.unwinder),
+          snapshot(session.snapshot), defer_symbols(session.defer_symbols), spread_ns(session.spread_ns) {}
+};
+
+// Samples are written into a caller-provided ThreadSample (or ProcessSample),
+// so that the frame buffers of previous samples are reused.
+
+// `state` must have been read with ThreadProcFiles::read_state() before the stop.
+Result<bool, std::string> sample_stopped_thread(SamplerContext& context, const ThreadStop& stop, const ThreadState& state, ThreadSample& thread_sample);
+// Copies the previous sample of a thread that has not run since, with a new
+// timestamp, and returns true. `state` must have been read just before.
+bool reuse_idle_sample(SamplerContext& context, pid_t tid, const ThreadState& state, ThreadSample& thread_sample);
+// Unwinds a stack captured by PerfEventSampler while the thread kept running.
+Result<bool, std::string> sample_captured_stack(SamplerContext& context, const CapturedStack& captured, ThreadSample& thread_sample);
+// Interrupts, samples and releases a single thread. Returns false if the thread is gone.
+Result<bool, std::string> sample_thread(SamplerContext& context, ThreadStop& stop, ThreadSample& thread_sample);
+// Resolves frame names of samples taken with `defer_symbols`, after the
+// threads were released. Each distinct IP is resolved once, against the same
+// PerfSymbolMap and ElfSymbolizer state the stacks were captured with.
+void symbolize_samples(SamplerContext& context, std::vector<ThreadSample>& thread_samples);
+// Replaces the contents of `result`.
+Result<bool, std::string> sample_process(SamplerContext& context, std::optional<uintptr_t> tid, ProcessSample& result);
+// Collects the samples taken by `sampler` since the previous call, keeping
+// its per-thread events in sync with the threads of the process.
+Result<bool, std::string> sample_perf_events(SamplerContext& context, PerfEventSampler& sampler, std::optional<uintptr_t> tid, ProcessSample& result);
@@ -0,0 +1,131 @@
+// Drives sample_process() against bench/synthetic_target and reports the
+// sampling latency per tick and its mean per thread, the time the target's threads
+// spend stopped, and throughput. Run through `meson test --benchmark`.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "backtrace.hpp"
+#include "perf_symbol_map.hpp"
+#include "phase_stats.hpp"
+#include "output_buffer.hpp"
+#include "target_process.hpp"
+
+using std::cerr;
+using std::string;
+using std::vector;
+
+struct BenchmarkArguments {
+    string target;
+    vector<string> target_args;
+    uint32_t ticks = 1000;
+    Unwinder unwinder = Unwinder::FramePointer;
+    uint32_t jobs = 1;
+    bool snapshot = false;
+    bool defer_symbols = false;
+};
+
+int main(int argc, char** argv) {
+    BenchmarkArguments args;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--target" && i + 1 < argc) {
+            args.target = argv[++i];
+        } else if (arg == "--ticks" && i + 1 < argc) {
+            args.ticks = atol(argv[++i]);
+        } else if (arg == "--unwinder" && i + 1 < argc) {
+            args.unwinder = string(argv[++i]) == "libunwind" ? Unwinder::Libunwind : Unwinder::FramePointer;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            args.jobs = atol(argv[++i]);
+        } else if (arg == "--snapshot") {
+            args.snapshot = true;
+        } else if (arg == "--defer_symbols") {
+            args.defer_symbols = true;
+        } else if (arg == "--") {
+            // the rest goes to the target
+            args.target_args.assign(argv + i + 1, argv + argc);
+            break;
+        } else {
+            cerr << "Unknown argument: " << arg << "\n";
+            cerr << "Usage: sample_benchmark --target PATH [--ticks 1000] [--unwinder fp|libunwind] [--jobs 1] [--snapshot] [--defer_symbols] [-- TARGET_ARGS]\n";
+            return 1;
+        }
+    }
+    if (args.target.empty() || args.jobs == 0) {
+        cerr << "--target must be specified and --jobs must be > 0\n";
+        return 1;
+    }
+
+    pid_t pid = start_target(args.target, args.target_args);
+    if (pid <= 0) {
+        cerr << "Cannot start " << args.target << "\n";
+        return 1;
+    }
+    TargetProcess target(pid);
+
+    StringPool string_pool;
+    PerfSymbolMap symbol_map(string_pool, pid);
+    SamplingSession session(string_pool, args.unwinder, args.jobs, args.snapshot, args.defer_symbols, 0);
+    SamplerContext context(session, symbol_map, pid);
+
+    // The first tick loads symbol tables and fills caches; keep it out of the numbers.
+    ProcessSample sample;
+    auto warmup_result = sample_process(context, std::nullopt, sample);
+    if (!warmup_result.isOk()) {
+        cerr << "Sampling failed: " << warmup_result.getErrRef() << "\n";
+        return 1;
+    }
+    context.phase_stats.reset();
+
+    // Tick duration divided by the number of sampled threads, one value per tick.
+    LatencyHistogram per_thread;
+    uint64_t thread_samples = 0;
+    uint64_t frames = 0;
+    uint64_t named_frames = 0;
+    double stop_seconds = 0;
+    auto started_at = std::chrono::steady_clock::now();
+    for (uint32_t tick = 0; tick < args.ticks; ++tick) {
+        auto result = sample_process(context, std::nullopt, sample);
+        if (!result.isOk()) {
+            cerr << "Sampling failed: " << result.getErrRef() << "\n";
+            return 1;
+        }
+
+        stop_seconds += sample.stats.total_stop_seconds;
+        thread_samples += sample.threads.size();
+        if (!sample.threads.empty()) {
+            per_thread.record((uint64_t) (sample.stats.duration_seconds * 1e9 / sample.threads.size()));
+        }
+        for (const auto& thread_sample: sample.threads) {
+            frames += thread_sample.frames.size();
+            for (const auto& frame: thread_sample.frames) {
+                named_frames += frame.name_id != StackFrame::NO_NAME;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+
+    const LatencyHistogram& tick = context.phase_stats.histogram(Phase::Tick);
+    printf("ticks: %u, thread samples: %llu, frames per sample: %.1f, named frames: %.1f%%\n",
+        args.ticks, (unsigned long long) thread_samples, thread_samples ? double(frames) / thread_samples : 0.0,
+        frames ? 100.0 * named_frames / frames : 0.0);
+    printf("tick latency: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        tick.sum() * 1e-3 / tick.count(), tick.percentile(0.5) * 1e-3, tick.percentile(0.99) * 1e-3, tick.max() * 1e-3);
+    printf("mean latency per thread: p50 %.1f us, p99 %.1f us\n", per_thread.percentile(0.5) * 1e-3, per_thread.percentile(0.99) * 1e-3);
+    printf("target stop time: %.1f us per thread sample, %.3f thread-seconds per second\n",
+        thread_samples ? stop_seconds * 1e6 / thread_samples : 0.0, stop_seconds / elapsed);
+    printf("throughput: %.0f thread samples/s, %.0f ticks/s\n", thread_samples / elapsed, args.ticks / elapsed);
+    fflush(stdout);
+
+    OutputBuffer out(1 << 12);
+    context.phase_stats.write_text(out);
+    out.flush_to(STDOUT_FILENO);
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Checks that StackSuffixCache::splice() reuses a cached caller chain only
+// while it is still in place: a frame whose sp moved or a caller whose return
+// address was overwritten must fall back to unwinding. The stack is a local
+// buffer served through RemoteMemory's stack snapshot. Run through
+// `meson test`.
+
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "remote_memory.hpp"
+#include "stack_cache.hpp"
+
+using std::cerr;
+using std::vector;
+
+static const size_t FRAMES = 4;
+static const size_t FRAME_WORDS = 8;
+
+struct FakeStack {
+    uint64_t words[FRAMES * FRAME_WORDS] = {};
+    uintptr_t ips[FRAMES];
+    uintptr_t sps[FRAMES];
+
+    FakeStack() {
+        for (size_t i = 0; i < FRAMES; ++i) {
+            ips[i] = 0x400000 + 0x100 * i;
+            sps[i] = (uintptr_t) &words[FRAME_WORDS * i + 1];
+            // The return address into frame i is stored just below its sp.
+            words[FRAME_WORDS * i] = ips[i];
+        }
+    }
+
+    void attach(RemoteMemory& memory) const {
+        uintptr_t start = (uintptr_t) words;
+        memory.set_stack_snapshot(start, (const uint8_t*) words, sizeof(words), start, start + sizeof(words));
+    }
+};
+
+static void record(StackSuffixCache& cache, const FakeStack& stack) {
+    cache.clear();
+    cache.begin();
+    for (size_t i = 0; i < FRAMES; ++i) {
+        cache.push(stack.ips[i], stack.sps[i]);
+    }
+    cache.commit();
+}
+
+static bool check(const char* name, bool spliced, bool expected) {
+    cerr << name << ": " << (spliced ? "spliced" : "rejected") << "\n";
+    if (spliced != expected) {
+        cerr << name << ": expected " << (expected ? "spliced" : "rejected") << "\n";
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    FakeStack stack;
+    RemoteMemory memory(getpid());
+    StackSuffixCache cache;
+    vector<uintptr_t> ips;
+    bool ok = true;
+
+    memory.reset();
+    stack.attach(memory);
+    record(cache, stack);
+    cache.begin();
+    ips.clear();
+    bool spliced = cache.splice(memory, stack.ips[1], stack.sps[1], ips);
+    ok &= check("unchanged", spliced, true);
+    if (spliced && ips != vector<uintptr_t>(stack.ips + 1, stack.ips + FRAMES)) {
+        cerr << "unchanged: wrong spliced frames\n";
+        ok = false;
+    }
+
+    record(cache, stack);
+    cache.begin();
+    ips.clear();
+    ok &= check("leaf", cache.splice(memory, stack.ips[0], stack.sps[0], ips), false);
+
+    record(cache, stack);
+    cache.begin();
+    ips.clear();
+    ok &= check("moved sp", cache.splice(memory, stack.ips[1], stack.sps[1] + sizeof(uint64_t), ips), false);
+
+    // Same (ip, sp) for frame 1, but an outer caller returns elsewhere now.
+    record(cache, stack);
+    stack.words[FRAME_WORDS * (FRAMES - 1)] = 0xdead;
+    memory.reset();
+    stack.attach(memory);
+    cache.begin();
+    ips.clear();
+    ok &= check("changed return address", cache.splice(memory, stack.ips[1], stack.sps[1], ips), false);
+    if (!ips.empty()) {
+        cerr << "changed return address: frames appended despite the rejection\n";
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+// Checks that the sampling loop does not allocate once its buffers and caches
+// are warm: every operator new is counted while bench/synthetic_target is
+// sampled on a schedule, and the samples go through AsyncSampleWriter (perf
+// script output to /dev/null) and come back for reuse, as in mono_ssp's main
+// loop. Run through `meson test`.
+//
+// Allocations made with malloc() directly (libunwind, libc) are not seen here.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "backtrace.hpp"
+#include "perf_symbol_map.hpp"
+#include "sample_writer.hpp"
+#include "scheduler.hpp"
+#include "target_process.hpp"
+
+using std::cerr;
+using std::string;
+using std::vector;
+
+static std::atomic<bool> counting { false };
+static std::atomic<uint64_t> allocations { 0 };
+
+static void* counted_allocation(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* result = malloc(size == 0 ? 1 : size);
+    if (result == nullptr) {
+        throw std::bad_alloc();
+    }
+    return result;
+}
+
+void* operator new(size_t size) {
+    return counted_allocation(size);
+}
+
+void* operator new[](size_t size) {
+    return counted_allocation(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+static const uint32_t WARMUP_TICKS = 50;
+static const uint32_t MEASURED_TICKS = 200;
+// Leaves the writer time to hand each sample back before the next tick.
+static const uint64_t TICK_NS = 10 * 1000 * 1000;
+static const size_t OUTPUT_QUEUE_CAPACITY = 256;
+
+struct Configuration {
+    const char* name;
+    Unwinder unwinder;
+    size_t jobs;
+    bool snapshot;
+    bool defer_symbols;
+};
+
+// Returns the number of allocations in MEASURED_TICKS, or -1 if sampling failed.
+static int64_t count_allocations(const Configuration& configuration, pid_t pid) {
+    StringPool string_pool;
+    PerfSymbolMap symbol_map(string_pool, pid);
+    SamplingSession session(string_pool, configuration.unwinder, configuration.jobs, configuration.snapshot, configuration.defer_symbols, 0);
+    SamplerContext context(session, symbol_map, pid);
+    OutputOptions output_options;
+    output_options.perf_script = true;
+    AsyncSampleWriter writer(string_pool, output_options, OUTPUT_QUEUE_CAPACITY);
+    SampleScheduler scheduler(TICK_NS, OverrunPolicy::Skip);
+    ProcessSample sample;
+    bool sampled_threads = false;
+
+    for (uint32_t tick = 0; tick < WARMUP_TICKS + MEASURED_TICKS; ++tick) {
+        if (tick == WARMUP_TICKS) {
+            allocations.store(0);
+            counting.store(true);
+        }
+        scheduler.wait();
+        auto result = sample_process(context, std::nullopt, sample);
+        if (!result.isOk()) {
+            counting.store(false);
+            cerr << configuration.name << ": sampling failed: " << result.getErrRef() << "\n";
+            return -1;
+        }
+        sampled_threads = sampled_threads || !sample.threads.empty();
+        if (writer.submit(std::move(sample))) {
+            writer.reuse(sample);
+        }
+    }
+    counting.store(false);
+    writer.finish();
+
+    if (!sampled_threads) {
+        cerr << configuration.name << ": no threads were sampled\n";
+        return -1;
+    }
+    if (writer.dropped() != 0) {
+        cerr << configuration.name << ": the writer dropped " << writer.dropped() << " samples\n";
+    }
+    return (int64_t) allocations.load();
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        cerr << "Usage: steady_state_allocations PATH_TO_SYNTHETIC_TARGET\n";
+        return 1;
+    }
+
+    pid_t pid = start_target(argv[1], { "--spinning", "2", "--blocked", "6", "--depth", "16", "--jit_symbols", "1000" });
+    if (pid <= 0) {
+        cerr << "Cannot start " << argv[1] << "\n";
+        return 1;
+    }
+    TargetProcess target(pid);
+
+    // The writer's perf script output is not needed, only its allocations.
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        cerr << "Cannot redirect stdout to /dev/null\n";
+        return 1;
+    }
+    close(null_fd);
+
+    const Configuration configurations[] = {
+        { "fp", Unwinder::FramePointer, 1, false, false },
+        { "libunwind", Unwinder::Libunwind, 1, false, false },
+        { "fp snapshot jobs=2", Unwinder::FramePointer, 2, true, false },
+        { "fp defer_symbols", Unwinder::FramePointer, 1, false, true },
+    };
+
+    bool failed = false;
+    for (const auto& configuration: configurations) {
+        int64_t count = count_allocations(configuration, pid);
+        if (count < 0) {
+            failed = true;
+            continue;
+        }
+        cerr << configuration.name << ": " << count << " allocations in " << MEASURED_TICKS << " ticks\n";
+        if (count != 0) {
+            failed = true;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
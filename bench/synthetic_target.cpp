@@ -0,0 +1,126 @@
+// Stand-in for a Mono process in benchmarks: threads that either spin or
+// block at a configurable stack depth, and a fake /tmp/perf-PID.map so the
+// JIT symbol path is exercised too. Prints "ready" once every thread has
+// reached its final depth and then runs until killed.
+//
+// Build with -fno-omit-frame-pointer, like MONO_DEBUG=disable_omit_fp.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+// Bytes attributed to each function in the fake perf map; the functions
+// below are kept tiny so this covers them.
+static const uintptr_t FUNCTION_SIZE = 64;
+static const uintptr_t FILLER_SYMBOL_SIZE = 256;
+
+static std::atomic<size_t> ready_threads { 0 };
+// Never set; keeps the thread functions formally returning.
+static std::atomic<bool> stopping { false };
+static std::mutex block_mutex;
+static std::condition_variable block_cv;
+
+__attribute__((noinline)) static void spin() {
+    volatile uint64_t counter = 0;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        counter = counter + 1;
+    }
+}
+
+__attribute__((noinline)) static void block() {
+    std::unique_lock<std::mutex> lock(block_mutex);
+    while (!stopping.load()) {
+        block_cv.wait(lock);
+    }
+}
+
+__attribute__((noinline)) static void frame(int depth, bool blocked) {
+    if (depth > 0) {
+        frame(depth - 1, blocked);
+        // keeps the call from becoming a tail call
+        asm volatile("" ::: "memory");
+        return;
+    }
+
+    ready_threads.fetch_add(1);
+    if (blocked) {
+        block();
+    } else {
+        spin();
+    }
+}
+
+static bool write_perf_map(size_t filler_symbols) {
+    std::ofstream out(std::string("/tmp/perf-") + std::to_string(getpid()) + ".map");
+    out << std::hex << (uintptr_t) &frame << " " << FUNCTION_SIZE << " Synthetic.Target:Frame (int,bool)\n";
+    out << std::hex << (uintptr_t) &spin << " " << FUNCTION_SIZE << " Synthetic.Target:Spin ()\n";
+
+    if (filler_symbols > 0) {
+        // Never executed; only makes the map as large as a real one.
+        size_t length = filler_symbols * FILLER_SYMBOL_SIZE;
+        void* region = mmap(nullptr, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED) {
+            return false;
+        }
+        for (size_t i = 0; i < filler_symbols; ++i) {
+            out << std::hex << (uintptr_t) region + i * FILLER_SYMBOL_SIZE << " " << FILLER_SYMBOL_SIZE
+                << " Synthetic.Filler:Method" << std::dec << i << " ()\n";
+        }
+    }
+
+    return bool(out);
+}
+
+int main(int argc, char** argv) {
+    size_t spinning = 4;
+    size_t blocked = 16;
+    int depth = 32;
+    size_t jit_symbols = 10000;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--spinning") {
+            spinning = atol(argv[i + 1]);
+        } else if (arg == "--blocked") {
+            blocked = atol(argv[i + 1]);
+        } else if (arg == "--depth") {
+            depth = atoi(argv[i + 1]);
+        } else if (arg == "--jit_symbols") {
+            jit_symbols = atol(argv[i + 1]);
+        } else {
+            std::cerr << "Usage: synthetic_target [--spinning 4] [--blocked 16] [--depth 32] [--jit_symbols 10000]\n";
+            return 1;
+        }
+    }
+
+    if (!write_perf_map(jit_symbols)) {
+        std::cerr << "Cannot write the perf map\n";
+        return 1;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < spinning + blocked; ++i) {
+        threads.emplace_back(frame, depth, i >= spinning);
+        threads.back().detach();
+    }
+
+    while (ready_threads.load() < spinning + blocked) {
+        usleep(1000);
+    }
+    std::cout << "ready" << std::endl;
+
+    while (true) {
+        pause();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Starts bench/synthetic_target for the benchmarks and tests in this directory.
+
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Started target process, killed on destruction.
+class TargetProcess {
+public:
+    explicit TargetProcess(pid_t pid) : pid(pid) {}
+    TargetProcess(const TargetProcess&) = delete;
+    ~TargetProcess() {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        unlink((std::string("/tmp/perf-") + std::to_string(pid) + ".map").c_str());
+    }
+
+    const pid_t pid;
+};
+
+// Starts the target and waits until its threads are in place.
+inline pid_t start_target(const std::string& target, const std::vector<std::string>& target_args) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(target.c_str()));
+        for (const auto& arg: target_args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    close(fds[1]);
+    char buffer[16];
+    ssize_t rc = pid > 0 ? read(fds[0], buffer, sizeof(buffer)) : -1;
+    close(fds[0]);
+    if (rc <= 0) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        return -1;
+    }
+    return pid;
+}
@@ -0,0 +1,600 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <utility>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "diff.hpp"
+#include "recording.hpp"
+#include "sample_writer.hpp"
+#include "stack_aggregator.hpp"
+#include "output_buffer.hpp"
+
+using std::cerr;
+using std::string;
+using std::string_view;
+using std::to_string;
+using std::vector;
+
+static const size_t READ_CHUNK_SIZE = 1 << 20;
+static const size_t DEFAULT_MAX_STACKS = 1000000;
+static const size_t DEFAULT_TOP = 20;
+
+enum class DiffFormat {
+    // Tables of the frames and call paths whose share changed most.
+    Report,
+    // "stack before after" per line, for flamegraph.pl (red/blue differential flame graphs).
+    Folded,
+};
+
+enum Side {
+    BEFORE = 0,
+    AFTER = 1,
+};
+
+// Stacks of both profiles, interned into one StackAggregator (whose own
+// counts are not used), with a sample count per side. Memory depends on the
+// number of distinct stacks, not on the size of the inputs.
+struct DiffProfile {
+    StringPool& string_pool;
+    StackAggregator stacks;
+    vector<uint64_t> counts[2];
+    uint64_t totals[2] = { 0, 0 };
+    // Samples left out by the thread filter.
+    uint64_t filtered[2] = { 0, 0 };
+    string thread_filter;
+    vector<uint64_t> scratch;
+
+    DiffProfile(StringPool& string_pool, size_t max_stacks, string thread_filter)
+        : string_pool(string_pool), stacks(string_pool, false, max_stacks), thread_filter(std::move(thread_filter)) {}
+
+    bool matches(string_view thread_name) const {
+        return thread_filter.empty() || thread_name.find(thread_filter) != string_view::npos;
+    }
+
+    void add(Side side, uint32_t stack_id, uint64_t count) {
+        vector<uint64_t>& side_counts = counts[side];
+        if (side_counts.size() <= stack_id) {
+            side_counts.resize(stack_id + 1, 0);
+        }
+        side_counts[stack_id] += count;
+        totals[side] += count;
+    }
+
+    uint64_t count(Side side, uint32_t stack_id) const {
+        return stack_id < counts[side].size() ? counts[side][stack_id] : 0;
+    }
+};
+
+// Reads a file line by line through a buffer that only grows for lines
+// longer than it, so inputs of any size are read in constant memory.
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd), buffer(READ_CHUNK_SIZE) {}
+
+    // Returns false at the end of the file. `line` excludes the newline and
+    // is valid until the next call.
+    Result<bool, string> next(string_view& line) {
+        while (true) {
+            const char* start = buffer.data() + begin;
+            const char* newline = static_cast<const char*>(memchr(start, '\n', end - begin));
+            if (newline != nullptr) {
+                line = string_view(start, newline - start);
+                begin = newline - buffer.data() + 1;
+                return ResultInit::ok(true);
+            }
+            if (eof) {
+                if (begin == end) {
+                    return ResultInit::ok(false);
+                }
+                line = string_view(start, end - begin);
+                begin = end;
+                return ResultInit::ok(true);
+            }
+
+            memmove(buffer.data(), start, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+            ssize_t rc = read(fd, buffer.data() + end, buffer.size() - end);
+            if (rc < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int errno_copy = errno;
+                return ResultInit::err("read() failed: errno = " + to_string(errno_copy) + " message = " + strerror(errno_copy));
+            }
+            if (rc == 0) {
+                eof = true;
+            } else {
+                end += rc;
+            }
+        }
+    }
+
+private:
+    int fd;
+    vector<char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;
+};
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool parse_count(string_view text, uint64_t& count) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), count);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size() && !text.empty();
+}
+
+// "outer;...;leaf count", as written by --collapsed, --daemon and stackcollapse-perf.pl.
+static bool is_folded_line(string_view line) {
+    size_t space = line.rfind(' ');
+    uint64_t count;
+    return !line.empty() && !is_space(line[0]) && space != string_view::npos && parse_count(line.substr(space + 1), count);
+}
+
+// With --thread, the root frame is taken as the thread name, as written by --collapsed_by_thread.
+static void add_folded_line(DiffProfile& profile, Side side, string_view line) {
+    size_t space = line.rfind(' ');
+    uint64_t count;
+    if (space == string_view::npos || !parse_count(line.substr(space + 1), count)) {
+        return;
+    }
+    string_view stack = line.substr(0, space);
+
+    profile.scratch.clear();
+    while (true) {
+        size_t separator = stack.find(';');
+        profile.scratch.push_back(profile.string_pool.intern(stack.substr(0, separator)));
+        if (separator == string_view::npos) {
+            break;
+        }
+        stack.remove_prefix(separator + 1);
+    }
+
+    if (!profile.matches(profile.string_pool.get_by_id(profile.scratch[0]))) {
+        profile.filtered[side] += count;
+        return;
+    }
+    profile.add(side, profile.stacks.intern(profile.scratch.data(), profile.scratch.size()), count);
+}
+
+// "\t    ip name+0xoffset (module)" -> "name"
+static string_view perf_script_frame_name(string_view line) {
+    while (!line.empty() && is_space(line[0])) {
+        line.remove_prefix(1);
+    }
+    size_t ip_end = line.find(' ');
+    if (ip_end == string_view::npos) {
+        return "[unknown]";
+    }
+    string_view name = line.substr(ip_end + 1);
+
+    // The module is last; names themselves may contain " (".
+    size_t module = name.rfind(" (");
+    if (module != string_view::npos && name.back() == ')') {
+        name = name.substr(0, module);
+    }
+    size_t offset = name.rfind("+0x");
+    if (offset != string_view::npos && name.find_first_not_of("0123456789abcdefABCDEF", offset + 3) == string_view::npos) {
+        name = name.substr(0, offset);
+    }
+    if (name.empty() || name == "unknown") {
+        return "[unknown]";
+    }
+    return name;
+}
+
+// "comm [pid/]tid [cpu] ..." -> "comm"; thread names may contain spaces.
+static string_view perf_script_thread_name(string_view header) {
+    size_t cpu = header.find(" [");
+    if (cpu == string_view::npos) {
+        return header.substr(0, header.find(' '));
+    }
+    string_view name = header.substr(0, cpu);
+    size_t tid = name.find_last_not_of(' ');
+    tid = tid == string_view::npos ? string_view::npos : name.rfind(' ', tid);
+    if (tid == string_view::npos) {
+        return name;
+    }
+    return name.substr(0, name.find_last_not_of(' ', tid) + 1);
+}
+
+// Sample headers start in the first column ("comm [pid/]tid [cpu] time: event"),
+// followed by indented frames, leaf first, and an empty line.
+static Result<bool, string> read_perf_script(DiffProfile& profile, Side side, LineReader& reader, string_view first_line) {
+    string thread_name;
+    bool in_sample = false;
+
+    auto finish_sample = [&]() {
+        if (!in_sample) {
+            return;
+        }
+        in_sample = false;
+        if (!profile.matches(thread_name)) {
+            profile.filtered[side] += 1;
+            return;
+        }
+        if (profile.scratch.empty()) {
+            profile.scratch.push_back(profile.string_pool.intern("[unknown]"));
+        }
+        std::reverse(profile.scratch.begin(), profile.scratch.end());
+        profile.add(side, profile.stacks.intern(profile.scratch.data(), profile.scratch.size()), 1);
+    };
+
+    auto handle_line = [&](string_view line) {
+        if (line.empty()) {
+            finish_sample();
+        } else if (is_space(line[0])) {
+            if (in_sample) {
+                profile.scratch.push_back(profile.string_pool.intern(perf_script_frame_name(line)));
+            }
+        } else {
+            finish_sample();
+            in_sample = true;
+            thread_name.assign(perf_script_thread_name(line));
+            profile.scratch.clear();
+        }
+    };
+
+    handle_line(first_line);
+    string_view line;
+    while (true) {
+        auto next_result = reader.next(line);
+        if (!next_result.isOk()) {
+            return next_result;
+        }
+        if (!next_result.getOkRef()) {
+            break;
+        }
+        handle_line(line);
+    }
+    finish_sample();
+    return ResultInit::ok(true);
+}
+
+static Result<bool, string> read_recording(DiffProfile& profile, Side side, const string& path) {
+    auto reader_result = RecordReader::open(path, profile.string_pool);
+    if (!reader_result.isOk()) {
+        return ResultInit::err(string(reader_result.getErrRef()));
+    }
+    auto reader = std::move(reader_result).getOkRef();
+
+    ProcessSample process_sample;
+    while (true) {
+        auto next_result = reader->next(process_sample);
+        if (!next_result.isOk() || !next_result.getOkRef()) {
+            return next_result;
+        }
+        for (const auto& thread_sample: process_sample.threads) {
+            if (!profile.matches(profile.string_pool.get_by_id(thread_sample.thread_name_id))) {
+                profile.filtered[side] += 1;
+                continue;
+            }
+            profile.add(side, profile.stacks.intern(thread_sample), 1);
+        }
+    }
+}
+
+// Reads a --record file, perf script output or folded stacks, telling them
+// apart by their first bytes.
+static Result<bool, string> read_profile(DiffProfile& profile, Side side, const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        int errno_copy = errno;
+        return ResultInit::err(string("open(") + path + ") failed: errno = " + to_string(errno_copy) + " message = " + strerror(errno_copy));
+    }
+
+    char magic[sizeof(RECORD_MAGIC)];
+    if (pread(fd, magic, sizeof(magic), 0) == (ssize_t) sizeof(magic) && memcmp(magic, RECORD_MAGIC, sizeof(magic)) == 0) {
+        close(fd);
+        return read_recording(profile, side, path);
+    }
+
+    LineReader reader(fd);
+    string_view line;
+    Result<bool, string> result = ResultInit::ok(true);
+    while (true) {
+        auto next_result = reader.next(line);
+        if (!next_result.isOk() || !next_result.getOkRef()) {
+            result = std::move(next_result);
+            break;
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        if (is_folded_line(line)) {
+            add_folded_line(profile, side, line);
+            while ((next_result = reader.next(line)).isOk() && next_result.getOkRef()) {
+                add_folded_line(profile, side, line);
+            }
+            result = std::move(next_result);
+        } else {
+            result = read_perf_script(profile, side, reader, line);
+        }
+        break;
+    }
+    close(fd);
+    return result;
+}
+
+struct Share {
+    uint64_t inclusive[2] = { 0, 0 };
+    uint64_t exclusive[2] = { 0, 0 };
+};
+
+struct FrameShare {
+    Share share;
+    // Stack id + 1 that was last counted, so recursion is counted once.
+    uint32_t last_stack = 0;
+};
+
+// Prefix of stacks, root first.
+struct PathNode {
+    uint32_t parent;
+    uint64_t name_id;
+    Share share;
+};
+
+static const uint32_t NO_PARENT = (uint32_t) -1;
+
+struct PathKey {
+    uint32_t parent;
+    uint64_t name_id;
+
+    bool operator==(const PathKey& other) const {
+        return parent == other.parent && name_id == other.name_id;
+    }
+};
+
+struct PathKeyHash {
+    size_t operator()(const PathKey& key) const {
+        return std::hash<uint64_t>()(key.name_id * 0x9e3779b97f4a7c15ULL ^ key.parent);
+    }
+};
+
+class ShareTable {
+public:
+    explicit ShareTable(const DiffProfile& profile) : profile(profile) {}
+
+    double fraction(Side side, uint64_t count) const {
+        return profile.totals[side] == 0 ? 0.0 : double(count) / profile.totals[side];
+    }
+    double inclusive_change(const Share& share) const {
+        return fraction(AFTER, share.inclusive[AFTER]) - fraction(BEFORE, share.inclusive[BEFORE]);
+    }
+    double exclusive_change(const Share& share) const {
+        return fraction(AFTER, share.exclusive[AFTER]) - fraction(BEFORE, share.exclusive[BEFORE]);
+    }
+
+    void append_percent(OutputBuffer& out, double value, bool sign) const {
+        char text[32];
+        snprintf(text, sizeof(text), sign ? "%+8.2f%%" : "%8.2f%%", value * 100);
+        out.append(text);
+    }
+
+    void append_row(OutputBuffer& out, const Share& share) const {
+        append_percent(out, inclusive_change(share), true);
+        append_percent(out, fraction(BEFORE, share.inclusive[BEFORE]), false);
+        append_percent(out, fraction(AFTER, share.inclusive[AFTER]), false);
+        out.append("  ");
+        append_percent(out, exclusive_change(share), true);
+        append_percent(out, fraction(BEFORE, share.exclusive[BEFORE]), false);
+        append_percent(out, fraction(AFTER, share.exclusive[AFTER]), false);
+        out.append("  ");
+    }
+
+private:
+    const DiffProfile& profile;
+};
+
+// Indices of the `top` items with the largest absolute change.
+template <typename Change>
+static vector<size_t> top_changes(size_t size, size_t top, Change&& change) {
+    vector<size_t> order(size);
+    for (size_t i = 0; i < size; ++i) {
+        order[i] = i;
+    }
+    size_t count = std::min(top, size);
+    std::partial_sort(order.begin(), order.begin() + count, order.end(), [&](size_t a, size_t b) {
+        return std::fabs(change(a)) > std::fabs(change(b));
+    });
+    order.resize(count);
+    return order;
+}
+
+static void write_report(const DiffProfile& profile, size_t top, OutputBuffer& out) {
+    std::unordered_map<uint64_t, FrameShare> frame_shares;
+    vector<PathNode> nodes;
+    std::unordered_map<PathKey, uint32_t, PathKeyHash> node_index;
+
+    for (uint32_t stack_id = 0; stack_id < profile.stacks.distinct_stacks(); ++stack_id) {
+        uint64_t counts[2] = { profile.count(BEFORE, stack_id), profile.count(AFTER, stack_id) };
+        if (counts[BEFORE] == 0 && counts[AFTER] == 0) {
+            continue;
+        }
+        size_t length;
+        const uint64_t* name_ids = profile.stacks.frames(stack_id, length);
+
+        uint32_t parent = NO_PARENT;
+        for (size_t i = 0; i < length; ++i) {
+            FrameShare& frame = frame_shares[name_ids[i]];
+            auto it = node_index.emplace(PathKey { parent, name_ids[i] }, (uint32_t) nodes.size()).first;
+            if (it->second == nodes.size()) {
+                nodes.push_back(PathNode { parent, name_ids[i], Share() });
+            }
+            PathNode& node = nodes[it->second];
+            for (int side: { BEFORE, AFTER }) {
+                node.share.inclusive[side] += counts[side];
+                if (frame.last_stack != stack_id + 1) {
+                    frame.share.inclusive[side] += counts[side];
+                }
+                if (i + 1 == length) {
+                    node.share.exclusive[side] += counts[side];
+                    frame.share.exclusive[side] += counts[side];
+                }
+            }
+            frame.last_stack = stack_id + 1;
+            parent = it->second;
+        }
+    }
+
+    ShareTable table(profile);
+    vector<std::pair<uint64_t, Share>> frames;
+    frames.reserve(frame_shares.size());
+    for (const auto& entry: frame_shares) {
+        frames.emplace_back(entry.first, entry.second.share);
+    }
+
+    const char* header = "  change   before    after     excl change   before    after  ";
+    auto write_frames = [&](const char* title, bool by_inclusive) {
+        out.append(title).append(" (top ").append_dec(top).append(")\n").append(header).append("frame\n");
+        auto order = top_changes(frames.size(), top, [&](size_t i) {
+            return by_inclusive ? table.inclusive_change(frames[i].second) : table.exclusive_change(frames[i].second);
+        });
+        for (size_t i: order) {
+            table.append_row(out, frames[i].second);
+            out.append(profile.string_pool.get_by_id(frames[i].first)).append('\n');
+        }
+        out.append('\n');
+    };
+    write_frames("Frames by change in inclusive share", true);
+    write_frames("Frames by change in exclusive share", false);
+
+    out.append("Call paths by change in inclusive share (top ").append_dec(top).append(")\n").append(header).append("path\n");
+    auto order = top_changes(nodes.size(), top, [&](size_t i) {
+        return table.inclusive_change(nodes[i].share);
+    });
+    vector<uint64_t> path;
+    for (size_t i: order) {
+        table.append_row(out, nodes[i].share);
+        path.clear();
+        for (uint32_t node = i; node != NO_PARENT; node = nodes[node].parent) {
+            path.push_back(nodes[node].name_id);
+        }
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            if (it != path.rbegin()) {
+                out.append(';');
+            }
+            append_folded_frame(out, profile.string_pool.get_by_id(*it));
+        }
+        out.append('\n');
+    }
+}
+
+// Brendan Gregg's difffolded.pl format, "stack before after", with the
+// "before" counts scaled to the total of "after" (as difffolded.pl -n does).
+static void write_folded(const DiffProfile& profile, OutputBuffer& out) {
+    double scale = profile.totals[BEFORE] == 0 ? 0.0 : double(profile.totals[AFTER]) / profile.totals[BEFORE];
+    for (uint32_t stack_id = 0; stack_id < profile.stacks.distinct_stacks(); ++stack_id) {
+        uint64_t before = profile.count(BEFORE, stack_id);
+        uint64_t after = profile.count(AFTER, stack_id);
+        if (before == 0 && after == 0) {
+            continue;
+        }
+
+        size_t length;
+        const uint64_t* name_ids = profile.stacks.frames(stack_id, length);
+        for (size_t i = 0; i < length; ++i) {
+            if (i > 0) {
+                out.append(';');
+            }
+            append_folded_frame(out, profile.string_pool.get_by_id(name_ids[i]));
+        }
+        out.append(' ').append_dec((int64_t) std::llround(before * scale)).append(' ').append_dec(after).append('\n');
+
+        if (out.size() >= AsyncSampleWriter::FLUSH_THRESHOLD) {
+            out.flush_to(STDOUT_FILENO);
+        }
+    }
+}
+
+int diff_main(int argc, char** argv) {
+    vector<string> args { &argv[1], &argv[argc] };
+    vector<string> paths;
+    DiffFormat format = DiffFormat::Report;
+    string thread_filter;
+    size_t top = DEFAULT_TOP;
+    size_t max_stacks = DEFAULT_MAX_STACKS;
+    bool parsed = true;
+
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        if (*it == "--format" && it + 1 != args.end()) {
+            ++it;
+            if (*it == "report") {
+                format = DiffFormat::Report;
+            } else if (*it == "folded") {
+                format = DiffFormat::Folded;
+            } else {
+                cerr << "Unknown format: " << *it << "\n";
+                parsed = false;
+            }
+        } else if (*it == "--thread" && it + 1 != args.end()) {
+            ++it;
+            thread_filter = *it;
+        } else if (*it == "--top" && it + 1 != args.end()) {
+            ++it;
+            top = atol(it->c_str());
+        } else if (*it == "--max_stacks" && it + 1 != args.end()) {
+            ++it;
+            max_stacks = atol(it->c_str());
+        } else if (it->rfind("--", 0) != 0) {
+            paths.push_back(*it);
+        } else {
+            cerr << "Unknown arguments: " << *it << "\n";
+            parsed = false;
+        }
+    }
+
+    if (!parsed || paths.size() != 2) {
+        cerr << "Usage: mono-ssp diff BEFORE AFTER [--format report|folded] [--thread NAME] [--top 20] [--max_stacks 1000000]\n";
+        cerr << "BEFORE and AFTER may be --record files, --perf_script output or folded stacks (--collapsed, --daemon windows)\n";
+        return 1;
+    }
+
+    StringPool string_pool;
+    DiffProfile profile(string_pool, max_stacks, thread_filter);
+    for (Side side: { BEFORE, AFTER }) {
+        auto read_result = read_profile(profile, side, paths[side]);
+        if (!read_result.isOk()) {
+            cerr << paths[side] << ": " << read_result.getErrRef() << "\n";
+            return 1;
+        }
+        cerr << (side == BEFORE ? "Before: " : "After: ") << paths[side] << ", " << profile.totals[side] << " samples";
+        if (profile.filtered[side] > 0) {
+            cerr << " (" << profile.filtered[side] << " of other threads left out)";
+        }
+        cerr << "\n";
+        if (profile.totals[side] == 0) {
+            cerr << paths[side] << ": no samples to compare\n";
+            return 1;
+        }
+    }
+    if (profile.stacks.truncated_samples() > 0) {
+        cerr << "More than " << max_stacks << " distinct stacks; " << profile.stacks.truncated_samples() << " sample groups counted as [truncated]\n";
+    }
+
+    OutputBuffer out;
+    if (format == DiffFormat::Folded) {
+        write_folded(profile, out);
+    } else {
+        write_report(profile, top, out);
+    }
+    out.flush_to(STDOUT_FILENO);
+    return 0;
+}
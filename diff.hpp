@@ -0,0 +1,4 @@
+#pragma once
+
+// `mono_ssp diff BEFORE AFTER ...`: compares two profiles. argv[0] is "diff".
+int diff_main(int argc, char** argv);
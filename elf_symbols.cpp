@@ -0,0 +1,338 @@
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <elf.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf_symbols.hpp"
+
+using std::string;
+using std::to_string;
+using std::move;
+using std::vector;
+
+static const char DEBUG_DIRECTORY[] = "/usr/lib/debug";
+
+static Result<bool, string> map_file(const string& path, const uint8_t*& data, size_t& size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ResultInit::err(string("open(") + path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return ResultInit::err(path + " is not an ELF file");
+    }
+
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return ResultInit::err(string("mmap(") + path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+    }
+
+    data = static_cast<const uint8_t*>(mapped);
+    size = st.st_size;
+    return ResultInit::ok(true);
+}
+
+static bool is_elf64(const uint8_t* data, size_t size) {
+    if (size < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0 || data[EI_CLASS] != ELFCLASS64) {
+        return false;
+    }
+    const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(data);
+    uint64_t sections_end = header->e_shoff + (uint64_t) header->e_shnum * sizeof(Elf64_Shdr);
+    uint64_t segments_end = header->e_phoff + (uint64_t) header->e_phnum * sizeof(Elf64_Phdr);
+    return sections_end <= size && segments_end <= size;
+}
+
+static const Elf64_Shdr* section_headers(const uint8_t* data) {
+    const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(data);
+    return reinterpret_cast<const Elf64_Shdr*>(data + header->e_shoff);
+}
+
+// Returns the section named `name`, or nullptr.
+static const Elf64_Shdr* find_section(const uint8_t* data, size_t size, const char* name) {
+    const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(data);
+    if (header->e_shstrndx == SHN_UNDEF || header->e_shstrndx >= header->e_shnum) {
+        return nullptr;
+    }
+    const Elf64_Shdr* sections = section_headers(data);
+    const Elf64_Shdr& names = sections[header->e_shstrndx];
+    if (names.sh_offset + names.sh_size > size) {
+        return nullptr;
+    }
+
+    size_t name_length = strlen(name);
+    for (size_t i = 0; i < header->e_shnum; ++i) {
+        uint32_t offset = sections[i].sh_name;
+        if (offset + name_length < names.sh_size
+                && memcmp(data + names.sh_offset + offset, name, name_length + 1) == 0) {
+            return &sections[i];
+        }
+    }
+    return nullptr;
+}
+
+static string directory_of(const string& path) {
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? string() : path.substr(0, slash);
+}
+
+Result<std::unique_ptr<ElfModule>, string> ElfModule::load(const string& root, const string& path) {
+    std::unique_ptr<ElfModule> module(new ElfModule());
+    auto map_result = map_file(root + path, module->image.data, module->image.size);
+    if (!map_result.isOk()) {
+        return ResultInit::err(move(map_result).getErrRef());
+    }
+    if (!is_elf64(module->image.data, module->image.size)) {
+        return ResultInit::err(path + " is not a 64-bit ELF file");
+    }
+
+    const uint8_t* data = module->image.data;
+    const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(data);
+    const Elf64_Phdr* program_headers = reinterpret_cast<const Elf64_Phdr*>(data + header->e_phoff);
+    for (size_t i = 0; i < header->e_phnum; ++i) {
+        const Elf64_Phdr& segment = program_headers[i];
+        if (segment.p_type == PT_LOAD) {
+            module->segments.push_back(LoadSegment { segment.p_offset, segment.p_filesz, segment.p_vaddr });
+        }
+    }
+
+    module->find_debug_file(root, path);
+    module->add_symbols(module->image);
+    if (module->debug_image.data != nullptr) {
+        module->add_symbols(module->debug_image);
+    }
+    module->finish_symbols();
+
+    return ResultInit::ok(move(module));
+}
+
+ElfModule::~ElfModule() {
+    for (Image* mapped: { &image, &debug_image }) {
+        if (mapped->data != nullptr) {
+            munmap(const_cast<uint8_t*>(mapped->data), mapped->size);
+            mapped->data = nullptr;
+        }
+    }
+}
+
+void ElfModule::find_debug_file(const string& root, const string& path) {
+    vector<string> candidates;
+
+    // /usr/lib/debug/.build-id/xx/yyyy.debug
+    const Elf64_Shdr* note = find_section(image.data, image.size, ".note.gnu.build-id");
+    if (note != nullptr && note->sh_offset + note->sh_size <= image.size && note->sh_size > sizeof(Elf64_Nhdr)) {
+        const Elf64_Nhdr* header = reinterpret_cast<const Elf64_Nhdr*>(image.data + note->sh_offset);
+        size_t descriptor_offset = sizeof(Elf64_Nhdr) + ((header->n_namesz + 3) & ~3u);
+        if (header->n_type == NT_GNU_BUILD_ID && descriptor_offset + header->n_descsz <= note->sh_size && header->n_descsz > 1) {
+            const uint8_t* id = image.data + note->sh_offset + descriptor_offset;
+            static const char HEX[] = "0123456789abcdef";
+            string hex;
+            for (size_t i = 0; i < header->n_descsz; ++i) {
+                hex.push_back(HEX[id[i] >> 4]);
+                hex.push_back(HEX[id[i] & 15]);
+            }
+            candidates.push_back(string(DEBUG_DIRECTORY) + "/.build-id/" + hex.substr(0, 2) + "/" + hex.substr(2) + ".debug");
+        }
+    }
+
+    // .gnu_debuglink: same directory, .debug/ subdirectory, or under /usr/lib/debug
+    const Elf64_Shdr* debuglink = find_section(image.data, image.size, ".gnu_debuglink");
+    if (debuglink != nullptr && debuglink->sh_offset + debuglink->sh_size <= image.size) {
+        const char* name = reinterpret_cast<const char*>(image.data + debuglink->sh_offset);
+        size_t name_length = strnlen(name, debuglink->sh_size);
+        if (name_length > 0 && name_length < debuglink->sh_size) {
+            string directory = directory_of(path);
+            candidates.push_back(directory + "/" + string(name, name_length));
+            candidates.push_back(directory + "/.debug/" + string(name, name_length));
+            candidates.push_back(string(DEBUG_DIRECTORY) + directory + "/" + string(name, name_length));
+        }
+    }
+
+    for (const auto& candidate: candidates) {
+        if (candidate == path) {
+            continue;
+        }
+        const uint8_t* data;
+        size_t size;
+        if (!map_file(root + candidate, data, size).isOk()) {
+            continue;
+        }
+        if (!is_elf64(data, size)) {
+            munmap(const_cast<uint8_t*>(data), size);
+            continue;
+        }
+        debug_image.data = data;
+        debug_image.size = size;
+        return;
+    }
+}
+
+void ElfModule::add_symbols(const Image& source) {
+    const Elf64_Ehdr* header = reinterpret_cast<const Elf64_Ehdr*>(source.data);
+    const Elf64_Shdr* sections = section_headers(source.data);
+
+    for (size_t i = 0; i < header->e_shnum; ++i) {
+        const Elf64_Shdr& section = sections[i];
+        if ((section.sh_type != SHT_SYMTAB && section.sh_type != SHT_DYNSYM) || section.sh_link >= header->e_shnum) {
+            continue;
+        }
+        const Elf64_Shdr& strings = sections[section.sh_link];
+        if (section.sh_offset + section.sh_size > source.size || strings.sh_offset + strings.sh_size > source.size
+                || strings.sh_type != SHT_STRTAB) {
+            continue;
+        }
+
+        const Elf64_Sym* entries = reinterpret_cast<const Elf64_Sym*>(source.data + section.sh_offset);
+        size_t count = section.sh_size / sizeof(Elf64_Sym);
+        const char* names = reinterpret_cast<const char*>(source.data + strings.sh_offset);
+        for (size_t j = 0; j < count; ++j) {
+            const Elf64_Sym& entry = entries[j];
+            unsigned type = ELF64_ST_TYPE(entry.st_info);
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) || entry.st_shndx == SHN_UNDEF
+                    || entry.st_value == 0 || entry.st_name >= strings.sh_size) {
+                continue;
+            }
+            symbols.push_back(Symbol { entry.st_value, entry.st_size, names + entry.st_name });
+        }
+    }
+}
+
+void ElfModule::finish_symbols() {
+    // Aliases share an address; keep the one with a size, then the first seen
+    // (.symtab of the main file comes before the debug file).
+    std::stable_sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) {
+        return a.start < b.start;
+    });
+
+    vector<Symbol> unique;
+    unique.reserve(symbols.size());
+    for (const auto& symbol: symbols) {
+        if (!unique.empty() && unique.back().start == symbol.start) {
+            if (unique.back().size == 0 && symbol.size != 0) {
+                unique.back() = symbol;
+            }
+            continue;
+        }
+        unique.push_back(symbol);
+    }
+    symbols = move(unique);
+    symbols.shrink_to_fit();
+}
+
+bool ElfModule::file_offset_to_address(uintptr_t file_offset, uintptr_t& address) const {
+    for (const auto& segment: segments) {
+        if (file_offset >= segment.file_offset && file_offset < segment.file_offset + segment.file_size) {
+            address = segment.address + (file_offset - segment.file_offset);
+            return true;
+        }
+    }
+    return false;
+}
+
+const ElfModule::Symbol* ElfModule::find(uintptr_t address) const {
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address, [](uintptr_t value, const Symbol& symbol) {
+        return value < symbol.start;
+    });
+    if (it == symbols.begin()) {
+        return nullptr;
+    }
+
+    const Symbol& symbol = *(it - 1);
+    // Symbols without a size extend to the next one.
+    if (symbol.size != 0 ? address - symbol.start < symbol.size : it != symbols.end()) {
+        return &symbol;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<ElfModule> ElfModuleCache::get(const string& root, const MemoryMapping& mapping) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = modules[ElfModuleKey(mapping.path, mapping.device, mapping.inode)];
+    std::shared_ptr<ElfModule> module = entry.lock();
+    if (module) {
+        return module;
+    }
+
+    auto load_result = ElfModule::load(root, mapping.path);
+    // Not fatal: such frames fall back to the remote lookup. Failures are
+    // not cached here, every symbolizer remembers its own.
+    if (load_result.isOk()) {
+        module = move(load_result).getOkRef();
+        entry = module;
+    }
+    return module;
+}
+
+ElfSymbolizer::ElfSymbolizer(StringPool& string_pool, ElfModuleCache& module_cache, pid_t pid)
+    : string_pool(string_pool), module_cache(module_cache), root(string("/proc/") + to_string(pid) + "/root") {}
+
+void ElfSymbolizer::update(const vector<MemoryMapping>& mappings) {
+    decltype(modules) previous = move(modules);
+    modules.clear();
+    ranges.clear();
+
+    for (const auto& mapping: mappings) {
+        if (!mapping.executable || mapping.path.empty() || mapping.path[0] != '/') {
+            continue;
+        }
+
+        ElfModuleKey key(mapping.path, mapping.device, mapping.inode);
+        auto it = modules.find(key);
+        if (it == modules.end()) {
+            auto previous_it = previous.find(key);
+            if (previous_it != previous.end()) {
+                it = modules.emplace(key, move(previous_it->second)).first;
+            } else {
+                it = modules.emplace(key, module_cache.get(root, mapping)).first;
+            }
+        }
+
+        ranges.push_back(Range { mapping.start, mapping.end, mapping.file_offset, string_pool.intern(mapping.path), it->second.get() });
+    }
+}
+
+const ElfSymbolizer::Range* ElfSymbolizer::find_range(uintptr_t ip) const {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), ip, [](uintptr_t value, const Range& range) {
+        return value < range.start;
+    });
+    if (it == ranges.begin() || ip >= (it - 1)->end) {
+        return nullptr;
+    }
+    return &*(it - 1);
+}
+
+uint64_t ElfSymbolizer::module_name(uintptr_t ip) const {
+    const Range* range = find_range(ip);
+    return range == nullptr ? NO_NAME : range->path_id;
+}
+
+bool ElfSymbolizer::resolve(uintptr_t ip, uint64_t& name_id, uintptr_t& name_offset) const {
+    const Range* range = find_range(ip);
+    if (range == nullptr || range->module == nullptr) {
+        return false;
+    }
+
+    uintptr_t address;
+    if (!range->module->file_offset_to_address(ip - range->start + range->file_offset, address)) {
+        return false;
+    }
+
+    const ElfModule::Symbol* symbol = range->module->find(address);
+    if (symbol == nullptr) {
+        return false;
+    }
+
+    name_id = string_pool.intern(std::string_view(symbol->name));
+    name_offset = address - symbol->start;
+    return true;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <tuple>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "result.hpp"
+#include "stringpool.hpp"
+#include "proc_maps.hpp"
+
+// Function symbols of one ELF file, read from the file itself (and from its
+// separate .debug file, if installed), never from the traced process.
+class ElfModule {
+public:
+    struct Symbol {
+        uintptr_t start;
+        uintptr_t size;
+        const char* name;
+    };
+
+    // `root` is prepended to every path, e.g. /proc/<pid>/root.
+    static Result<std::unique_ptr<ElfModule>, std::string> load(const std::string& root, const std::string& path);
+
+    ElfModule(const ElfModule&) = delete;
+    ~ElfModule();
+
+    // Translates an offset in the file into a link-time virtual address.
+    bool file_offset_to_address(uintptr_t file_offset, uintptr_t& address) const;
+    const Symbol* find(uintptr_t address) const;
+
+    size_t symbol_count() const { return symbols.size(); }
+    bool has_debug_file() const { return debug_image.data != nullptr; }
+
+private:
+    struct Image {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+    struct LoadSegment {
+        uintptr_t file_offset;
+        uintptr_t file_size;
+        uintptr_t address;
+    };
+
+    Image image;
+    Image debug_image;
+    std::vector<LoadSegment> segments;
+    // Sorted by start, without duplicates; names point into the images.
+    std::vector<Symbol> symbols;
+
+    ElfModule() = default;
+    void find_debug_file(const std::string& root, const std::string& path);
+    void add_symbols(const Image& source);
+    void finish_symbols();
+};
+
+// (path, device, inode) of a mapped file. Processes in other containers or
+// mount namespaces may map different files with the same path and inode.
+using ElfModuleKey = std::tuple<std::string, uint64_t, uint64_t>;
+
+// ELF files loaded for any of the profiled processes, keyed by ElfModuleKey,
+// so that libraries mapped by several processes are parsed only once.
+// A module is freed once no ElfSymbolizer uses it anymore.
+class ElfModuleCache {
+public:
+    ElfModuleCache() = default;
+    ElfModuleCache(const ElfModuleCache&) = delete;
+
+    // nullptr if the file could not be loaded.
+    std::shared_ptr<ElfModule> get(const std::string& root, const MemoryMapping& mapping);
+
+private:
+    std::mutex mutex;
+    std::map<ElfModuleKey, std::weak_ptr<ElfModule>> modules;
+};
+
+// Resolves native IPs of a process using the ELF files listed in its
+// /proc/<pid>/maps. Modules come from a session-wide ElfModuleCache and are
+// shared by all mappings of the same file.
+//
+// resolve() and module_name() may be called concurrently; update() must not
+// run at the same time as them.
+class ElfSymbolizer {
+public:
+    static const uint64_t NO_NAME = (uint64_t) -1;
+
+    ElfSymbolizer(StringPool& string_pool, ElfModuleCache& module_cache, pid_t pid);
+    ElfSymbolizer(const ElfSymbolizer&) = delete;
+
+    // Call whenever the maps change, see ProcMapsWatcher.
+    void update(const std::vector<MemoryMapping>& mappings);
+
+    // Interned path of the file mapped at `ip`, or NO_NAME.
+    uint64_t module_name(uintptr_t ip) const;
+    // Symbol containing `ip`; the offset is relative to the symbol start.
+    bool resolve(uintptr_t ip, uint64_t& name_id, uintptr_t& name_offset) const;
+
+    size_t module_count() const { return modules.size(); }
+
+private:
+    struct Range {
+        uintptr_t start;
+        uintptr_t end;
+        uintptr_t file_offset;
+        uint64_t path_id;
+        const ElfModule* module;
+    };
+
+    StringPool& string_pool;
+    ElfModuleCache& module_cache;
+    std::string root;
+    // nullptr if the file could not be loaded.
+    std::map<ElfModuleKey, std::shared_ptr<ElfModule>> modules;
+    // Executable file mappings, sorted by start.
+    std::vector<Range> ranges;
+
+    const Range* find_range(uintptr_t ip) const;
+};
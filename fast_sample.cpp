@@ -1,95 +1,122 @@
 #include <string>
 #include <utility>
-#include <iostream>
 #include <optional>
 
 #include <libunwind.h>
-#include <libunwind-ptrace.h>
-// #include <time.h>
-#include <stdlib.h>
 #include <stdint.h>
-#include <errno.h>
-#include <string.h>
-#include <dirent.h>
-#include <stdio.h>
-
-#include <sys/ptrace.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <sys/user.h>
 
 #include "result.hpp"
 #include "fast_sample.hpp"
 
-
-using std::optional;
 using std::string;
 using std::to_string;
-using std::move;
 using std::vector;
 
-class PtraceDetachGuard {
-    pid_t pid;
-public:
-    PtraceDetachGuard(pid_t pid): pid(pid) {}
-    PtraceDetachGuard(const PtraceDetachGuard&) = delete;
-    ~PtraceDetachGuard() {
-        if (pid) {
-            int rc = ptrace(PTRACE_DETACH, pid, 0, 0);
-            if (rc != 0) {
-                std::cerr << ("ptrace(PTRACE_DETACH) failed with errno = " + to_string(errno) + " message = " + strerror(errno)) << "\n";
-            }
-            pid = 0;
-        }
-    }
-};
+static const size_t MAX_FRAMES = 1024;
+// Frame pointers further than this from the stack pointer are treated as garbage.
+static const uintptr_t MAX_STACK_SIZE = 64 * 1024 * 1024;
 
+struct FrameRegisters {
+    uint64_t ip;
+    uint64_t sp;
+    uint64_t bp;
+};
 
-Result<std::vector<uintptr_t>, std::string> do_fast_sample(uintptr_t pid) {
+static bool frame_pointer_step(VmUnwindContext& context, FrameRegisters& frame) {
+    uint64_t bp = frame.bp;
+    if (bp < frame.sp || bp - frame.sp > MAX_STACK_SIZE || (bp & 7) != 0) {
+        return false;
+    }
 
-    pid_t target_pid = pid;
-    int rc;
+    uint64_t saved[2];
+    if (context.memory.read(bp, saved, sizeof(saved)) != sizeof(saved)) {
+        return false;
+    }
 
-    rc = ptrace(PTRACE_SEIZE, target_pid, 0, 0);
-    if (rc != 0) {
-        if (errno == ESRCH) {
-            // LWP does not exist
-            return ResultInit::ok(std::vector<uintptr_t>{});
-        }
+    uint64_t next_bp = saved[0];
+    uint64_t return_address = saved[1];
+    if (return_address == 0) {
+        return false;
+    }
+    // The chain must strictly move towards the stack base; 0 marks the outermost frame.
+    if (next_bp != 0 && next_bp <= bp) {
+        return false;
+    }
 
-        return ResultInit::err(std::string() + "ptrace(PTRACE_SEIZE) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
+    frame.ip = return_address;
+    frame.sp = bp + 16;
+    frame.bp = next_bp;
+    return true;
+}
+
+// Returns false at the end of the call chain.
+static Result<bool, string> libunwind_step(VmUnwindContext& context, unw_addr_space_t address_space, FrameRegisters& frame, bool leaf) {
+    if (!leaf) {
+        // Only ip, sp and bp are known above the leaf: anything left in the
+        // other registers belongs to the interrupted leaf and must not be
+        // taken for this frame's callee-saved values.
+        struct user_regs_struct& regs = context.regs;
+        regs.rax = regs.rbx = regs.rcx = regs.rdx = regs.rsi = regs.rdi = 0;
+        regs.r8 = regs.r9 = regs.r10 = regs.r11 = regs.r12 = regs.r13 = regs.r14 = regs.r15 = 0;
+    }
+    // libunwind takes the initial ip for the address of the interrupted
+    // instruction. Above the leaf it is a return address, which may already
+    // be past the end of the calling function, so give it the call instead.
+    context.regs.rip = leaf ? frame.ip : frame.ip - 1;
+    context.regs.rsp = frame.sp;
+    context.regs.rbp = frame.bp;
+
+    unw_cursor_t cursor;
+    int rc = unw_init_remote(&cursor, address_space, &context);
+    if (rc < 0) {
+        return ResultInit::err("unw_init_remote() failed with ret = " + to_string(rc));
     }
 
-    PtraceDetachGuard ptrace_detach_guard(target_pid);
+    rc = unw_step(&cursor);
+    if (rc <= 0) {
+        // Either the real end of the chain or a frame libunwind has no info
+        // for; in both cases there is nothing more we can trust.
+        return ResultInit::ok(false);
+    }
 
-    rc = ptrace(PTRACE_INTERRUPT, target_pid, 0, 0);
-    if (rc != 0) {
-        return ResultInit::err(std::string() + "ptrace(PTRACE_INTERRUPT) failed with errno = " + to_string(errno) + " message = " + strerror(errno));
+    unw_word_t ip, sp, bp;
+    if (unw_get_reg(&cursor, UNW_REG_IP, &ip) < 0
+            || unw_get_reg(&cursor, UNW_REG_SP, &sp) < 0
+            || unw_get_reg(&cursor, UNW_X86_64_RBP, &bp) < 0) {
+        return ResultInit::ok(false);
     }
 
-    {
-        int status;
-        pid_t tmp = waitpid(target_pid, &status, WCONTINUED);
-        if (tmp != target_pid) {
-            return ResultInit::err(std::string() + "waitpid() failed with ret = " + to_string(tmp) + " errno = " + to_string(errno) + " message = " + strerror(errno));
-        }
+    frame.ip = ip;
+    frame.sp = sp;
+    frame.bp = bp;
+    return ResultInit::ok(true);
+}
 
-        if (!WIFSTOPPED(status)) {
-            return ResultInit::err(std::string() + "waitpid() returned bad status: !WIFSTOPPED(status); status = " + to_string(status));
-        }
-    }
+Result<bool, string> fast_unwind(VmUnwindContext& context, unw_addr_space_t address_space, PerfSymbolMap& symbol_map, vector<uintptr_t>& ips) {
+    FrameRegisters frame { context.regs.rip, context.regs.rsp, context.regs.rbp };
 
-    struct user_regs_struct regs;
-    ptrace(PTRACE_GETREGS, target_pid, NULL, &regs);
+    context.stack_cache.begin();
+    while (ips.size() < MAX_FRAMES) {
+        if (!ips.empty() && context.stack_cache.splice(context.memory, frame.ip, frame.sp, ips)) {
+            break;
+        }
+        ips.push_back(frame.ip);
+        context.stack_cache.push(frame.ip, frame.sp);
 
-    vector<uintptr_t> result;
-    result.push_back(regs.rip);
-    result.push_back(regs.rsp);
-    result.push_back(regs.rbp);
+        bool is_jit_code = symbol_map.resolve(frame.ip).has_value();
+        if (is_jit_code && frame_pointer_step(context, frame)) {
+            continue;
+        }
 
-    return ResultInit::ok(move(result));
+        auto step_result = libunwind_step(context, address_space, frame, ips.size() == 1);
+        if (!step_result.isOk()) {
+            return step_result;
+        }
+        if (!step_result.getOkRef()) {
+            break;
+        }
+    }
+    context.stack_cache.commit();
 
-    // printf( “%lX\n”, regs.rip );
-    
-    // return ResultInit::err(std::string("not implemented"));
-}
\ No newline at end of file
+    return ResultInit::ok(true);
+}
@@ -4,6 +4,19 @@
 #include <string>
 #include <stdint.h>
 
+#include <libunwind.h>
+
 #include "result.hpp"
+#include "perf_symbol_map.hpp"
+#include "vm_accessors.hpp"
 
-Result<std::vector<uintptr_t>, std::string> do_fast_sample(uintptr_t pid);
\ No newline at end of file
+// Frame-pointer unwinder for ptrace-stopped threads with loaded registers.
+//
+// Mono JIT code (MONO_DEBUG=disable_omit_fp) always keeps an rbp chain, so
+// frames found in the perf map are stepped by reading [rbp] and [rbp + 8].
+// Native frames, and JIT frames where the chain does not look sane, are
+// stepped by libunwind from the current (ip, sp, bp) instead.
+//
+// Callers that did not change since the previous unwind of the thread are
+// taken from context.stack_cache instead of being stepped again.
+Result<bool, std::string> fast_unwind(VmUnwindContext& context, unw_addr_space_t address_space, PerfSymbolMap& symbol_map, std::vector<uintptr_t>& ips);
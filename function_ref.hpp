@@ -0,0 +1,29 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+template <typename Signature>
+class FunctionRef;
+
+// Non-owning reference to a callable, for callbacks that are only invoked
+// during the call they are passed to. Unlike std::function it never
+// allocates, which keeps lambdas with many captures off the heap.
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionRef>>>
+    FunctionRef(F&& fn)
+        : object(const_cast<void*>(static_cast<const void*>(&fn))),
+          trampoline([](void* object, Args... args) -> R {
+              return (*static_cast<std::remove_reference_t<F>*>(object))(std::forward<Args>(args)...);
+          }) {}
+
+    R operator()(Args... args) const {
+        return trampoline(object, std::forward<Args>(args)...);
+    }
+
+private:
+    void* object;
+    R (*trampoline)(void*, Args...);
+};
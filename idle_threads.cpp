@@ -0,0 +1,78 @@
+#include <unordered_set>
+
+#include "idle_threads.hpp"
+#include "backtrace.hpp"
+
+using std::vector;
+
+struct IdleThreadCache::Entry {
+    ThreadSample sample;
+    SchedStat schedstat;
+    // False until settle() has read the counters after the release.
+    bool settled = false;
+};
+
+IdleThreadCache::IdleThreadCache() = default;
+IdleThreadCache::~IdleThreadCache() = default;
+
+IdleThreadCache::Entry* IdleThreadCache::get(pid_t tid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = entries[tid];
+    if (!entry) {
+        entry = std::make_unique<Entry>();
+    }
+    return entry.get();
+}
+
+bool IdleThreadCache::reuse(pid_t tid, const ThreadState& state, const SchedStat& schedstat, ThreadSample& sample) {
+    if (state.run_state == 'R') {
+        return false;
+    }
+
+    Entry* entry = get(tid);
+    if (!entry->settled || !(entry->schedstat == schedstat)) {
+        return false;
+    }
+    const ThreadState& previous = entry->sample.state;
+    if (previous.run_state != state.run_state || previous.wchan_id != state.wchan_id) {
+        return false;
+    }
+
+    sample = entry->sample;
+    reused_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void IdleThreadCache::remember(const ThreadSample& sample) {
+    Entry* entry = get((pid_t) sample.tid);
+    entry->settled = false;
+    if (sample.state.run_state == 'R') {
+        // Never reused, see reuse().
+        entry->sample.frames.clear();
+        return;
+    }
+    entry->sample = sample;
+}
+
+void IdleThreadCache::settle(ThreadProcFiles& thread_files) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& item: entries) {
+        Entry& entry = *item.second;
+        if (entry.settled || entry.sample.frames.empty()) {
+            continue;
+        }
+        entry.settled = thread_files.read_schedstat(item.first, entry.schedstat);
+    }
+}
+
+void IdleThreadCache::retain_threads(const vector<uintptr_t>& tids) {
+    std::unordered_set<pid_t> alive(tids.begin(), tids.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (alive.count(it->first) == 0) {
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
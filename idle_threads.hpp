@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "thread_state.hpp"
+
+struct ThreadSample;
+
+// Last sample of every blocked thread, so that threads which have not been
+// scheduled since are not stopped and unwound again on every tick.
+//
+// Stopping a thread wakes it up, so the counters it is compared against are
+// read by settle(), after the thread was released and went back to sleep.
+// Each thread is only touched by the worker that owns it, except for
+// settle() and retain_threads(), which run between ticks.
+class IdleThreadCache {
+public:
+    IdleThreadCache();
+    IdleThreadCache(const IdleThreadCache&) = delete;
+    ~IdleThreadCache();
+
+    // Copies the previous sample of `tid` into `sample` if the thread is
+    // still blocked in the same place and its schedstat did not change.
+    bool reuse(pid_t tid, const ThreadState& state, const SchedStat& schedstat, ThreadSample& sample);
+    // Keeps a freshly unwound sample; it becomes reusable after settle().
+    void remember(const ThreadSample& sample);
+    // Records the current counters of threads remembered during this tick.
+    void settle(ThreadProcFiles& thread_files);
+    // Forgets threads that are not in `tids` anymore.
+    void retain_threads(const std::vector<uintptr_t>& tids);
+
+    // Session total of samples served by reuse().
+    uint64_t reused() const { return reused_.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry;
+
+    std::mutex mutex;
+    std::unordered_map<pid_t, std::unique_ptr<Entry>> entries;
+    std::atomic<uint64_t> reused_{0};
+
+    Entry* get(pid_t tid);
+};
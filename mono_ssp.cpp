@@ -3,57 +3,215 @@
 #include <string>
 #include <stdexcept>
 #include <chrono>
-#include <thread>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include "backtrace.hpp"
-#include "fast_sample.hpp"
 #include "perf_symbol_map.hpp"
+#include "sample_writer.hpp"
+#include "recording.hpp"
+#include "report.hpp"
+#include "diff.hpp"
+#include "scheduler.hpp"
+#include "process_set.hpp"
+#include "profile_windows.hpp"
+#include "window_server.hpp"
 
 #define PROJECT_NAME "mono-ssp"
 
+// Process samples waiting to be written out before new ones are dropped.
+static const size_t OUTPUT_QUEUE_CAPACITY = 256;
+// With --engine=perf the rings are drained every this many sampling periods;
+// a ring holds about 15 samples of PerfEventSampler::DEFAULT_STACK_SIZE.
+static const uint64_t PERF_DRAIN_PERIODS = 4;
+static const uint64_t PERF_MIN_DRAIN_NS = 1000000;
+static const uint64_t PERF_MAX_DRAIN_NS = 50000000;
+// How often new processes (--all_mono) and exited ones are looked for.
+static const uint64_t PROCESS_SCAN_INTERVAL_NS = 1000000000;
+
 using std::cerr;
-using std::cout;
 using std::vector;
 using std::string;
+using std::move;
+
+// Set by SIGINT/SIGTERM in --daemon mode.
+static std::atomic<bool> stop_requested { false };
 
 struct CliArguments {
     bool parsed;
-    uint32_t pid;
+    vector<uint32_t> pids;
+    bool all_mono;
     bool perf_script;
     bool debug;
-    int interval_ms;
+    double interval_ms;
     uint32_t count_samples;
     uint32_t tid;
     uint32_t duration_seconds;
+    Engine engine;
+    Unwinder unwinder;
+    uint32_t jobs;
+    bool snapshot;
+    bool defer_symbols;
+    OverrunPolicy overrun_policy;
+    bool spread;
+    bool stats;
+    bool stats_json;
+    bool collapsed;
+    bool collapsed_by_thread;
+    string record_path;
+    string daemon_directory;
+    uint32_t window_seconds;
+    uint32_t keep_windows;
+    uint32_t max_stacks;
+    string socket_path;
+    string dump_path;
 
     static CliArguments parse(int argc, char** argv) {
-        vector<string> args { &argv[1], &argv[argc] };
+        vector<string> args;
+        for (int i = 1; i < argc; ++i) {
+            // accept both "--option value" and "--option=value"
+            string arg = argv[i];
+            size_t eq = arg.find('=');
+            if (arg.rfind("--", 0) == 0 && eq != string::npos) {
+                args.push_back(arg.substr(0, eq));
+                args.push_back(arg.substr(eq + 1));
+            } else {
+                args.push_back(move(arg));
+            }
+        }
 
         bool parsed = true;
-        uint32_t pid = 0;
+        vector<uint32_t> pids;
+        bool all_mono = false;
         bool perf_script = false;
         bool debug = false;
-        int interval_ms = 10;
+        double interval_ms = 10;
         uint32_t count_samples = 0;
         uint32_t tid = 0;
         uint32_t duration_seconds = 0;
+        Engine engine = Engine::Ptrace;
+        Unwinder unwinder = Unwinder::Libunwind;
+        uint32_t jobs = 1;
+        bool snapshot = false;
+        bool defer_symbols = false;
+        OverrunPolicy overrun_policy = OverrunPolicy::Skip;
+        bool spread = false;
+        bool stats = false;
+        bool stats_json = false;
+        bool collapsed = false;
+        bool collapsed_by_thread = false;
+        string record_path;
+        string daemon_directory;
+        uint32_t window_seconds = 60;
+        uint32_t keep_windows = 60;
+        uint32_t max_stacks = 100000;
+        string socket_path;
+        string dump_path;
 
         for (auto it = args.begin(); it != args.end(); ++it) {
             if (*it == "--pid") {
                 ++it;
-                pid = atol(it->c_str());
+                pids.push_back(atol(it->c_str()));
+            } else if (*it == "--all_mono" || *it == "--all-mono") {
+                all_mono = true;
             } else if (*it == "--tid") {
                 ++it;
                 tid = atol(it->c_str());
             } else if (*it == "--interval_ms") {
                 ++it;
-                interval_ms = atol(it->c_str());
+                interval_ms = atof(it->c_str());
             } else if (*it == "--count_samples") {
                 ++it;
                 count_samples = atol(it->c_str());
             } else if (*it == "--duration_sec") {
                 ++it;
                 duration_seconds = atol(it->c_str());
+            } else if (*it == "--jobs") {
+                ++it;
+                jobs = atol(it->c_str());
+            } else if (*it == "--engine") {
+                ++it;
+                if (*it == "ptrace") {
+                    engine = Engine::Ptrace;
+                } else if (*it == "perf") {
+                    engine = Engine::Perf;
+                } else {
+                    cerr << "Unknown engine: " << *it << "\n";
+                    parsed = false;
+                }
+            } else if (*it == "--unwinder") {
+                ++it;
+                if (*it == "fp") {
+                    unwinder = Unwinder::FramePointer;
+                } else if (*it == "libunwind") {
+                    unwinder = Unwinder::Libunwind;
+                } else {
+                    cerr << "Unknown unwinder: " << *it << "\n";
+                    parsed = false;
+                }
+            } else if (*it == "--snapshot") {
+                snapshot = true;
+            } else if (*it == "--defer_symbols") {
+                defer_symbols = true;
+            } else if (*it == "--overrun") {
+                ++it;
+                if (*it == "skip") {
+                    overrun_policy = OverrunPolicy::Skip;
+                } else if (*it == "catch_up") {
+                    overrun_policy = OverrunPolicy::CatchUp;
+                } else {
+                    cerr << "Unknown overrun policy: " << *it << "\n";
+                    parsed = false;
+                }
+            } else if (*it == "--spread") {
+                spread = true;
+            } else if (*it == "--stats") {
+                stats = true;
+            } else if (*it == "--stats_format") {
+                ++it;
+                stats = true;
+                if (*it == "json") {
+                    stats_json = true;
+                } else if (*it == "text") {
+                    stats_json = false;
+                } else {
+                    cerr << "Unknown stats format: " << *it << "\n";
+                    parsed = false;
+                }
+            } else if (*it == "--collapsed") {
+                collapsed = true;
+            } else if (*it == "--collapsed_by_thread") {
+                collapsed = true;
+                collapsed_by_thread = true;
+            } else if (*it == "--record") {
+                ++it;
+                record_path = *it;
+            } else if (*it == "--daemon") {
+                ++it;
+                daemon_directory = *it;
+            } else if (*it == "--window_sec") {
+                ++it;
+                window_seconds = atol(it->c_str());
+            } else if (*it == "--keep_windows") {
+                ++it;
+                keep_windows = atol(it->c_str());
+            } else if (*it == "--max_stacks") {
+                ++it;
+                max_stacks = atol(it->c_str());
+            } else if (*it == "--socket") {
+                ++it;
+                socket_path = *it;
+            } else if (*it == "--dump_path") {
+                ++it;
+                dump_path = *it;
             } else if (*it == "--perf_script") {
                 perf_script = true;
             } else if (*it == "--debug") {
@@ -64,12 +222,64 @@ struct CliArguments {
             }
         }
 
-        if (pid == 0) {
-            cerr << "--pid must be specified and > 0\n";
+        if (pids.empty() && !all_mono) {
+            cerr << "--pid or --all_mono must be specified\n";
             parsed = false;
         }
+        for (uint32_t pid: pids) {
+            if (pid == 0) {
+                cerr << "--pid must be > 0\n";
+                parsed = false;
+            }
+        }
 
-        if ((count_samples == 0 && duration_seconds == 0) ||
+        if (tid != 0 && (pids.size() != 1 || all_mono)) {
+            cerr << "--tid requires exactly one --pid\n";
+            parsed = false;
+        }
+
+        if (!(interval_ms > 0)) {
+            cerr << "--interval_ms must be > 0\n";
+            parsed = false;
+        }
+
+        if (spread && snapshot) {
+            cerr << "--spread and --snapshot cannot be combined: a snapshot stops all threads at once\n";
+            parsed = false;
+        }
+
+        if (engine == Engine::Perf && (snapshot || spread)) {
+            cerr << "--snapshot and --spread only apply to --engine=ptrace\n";
+            parsed = false;
+        }
+
+        if (jobs == 0) {
+            cerr << "--jobs must be > 0\n";
+            parsed = false;
+        }
+
+        if (collapsed && perf_script) {
+            cerr << "--collapsed and --perf_script both write to stdout and cannot be combined\n";
+            parsed = false;
+        }
+
+        if (!daemon_directory.empty()) {
+            if (count_samples > 0 || duration_seconds > 0) {
+                cerr << "--daemon runs until it is stopped; --count_samples and --duration_sec do not apply\n";
+                parsed = false;
+            }
+            if (perf_script || (collapsed && !collapsed_by_thread) || !record_path.empty()) {
+                cerr << "--daemon only writes windows; --perf_script, --collapsed and --record do not apply\n";
+                parsed = false;
+            }
+            if (window_seconds == 0 || keep_windows == 0) {
+                cerr << "--window_sec and --keep_windows must be > 0\n";
+                parsed = false;
+            }
+            if (socket_path.empty()) {
+                socket_path = daemon_directory + "/mono_ssp.sock";
+            }
+        } else if ((count_samples == 0 && duration_seconds == 0) ||
             (count_samples > 0 && duration_seconds > 0)) {
             cerr << "Exactly one of --count_samples and --duration_sec must be specified\n";
             parsed = false;
@@ -77,134 +287,266 @@ struct CliArguments {
 
         return CliArguments {
             parsed,
-            pid,
+            pids,
+            all_mono,
             perf_script,
             debug,
             interval_ms,
             count_samples,
             tid,
-            duration_seconds
+            duration_seconds,
+            engine,
+            unwinder,
+            jobs,
+            snapshot,
+            defer_symbols,
+            overrun_policy,
+            spread,
+            stats,
+            stats_json,
+            collapsed,
+            collapsed_by_thread,
+            record_path,
+            daemon_directory,
+            window_seconds,
+            keep_windows,
+            max_stacks,
+            socket_path,
+            dump_path
         };
     }
 };
 
 int main(int argc, char **argv) {
+    if (argc > 1 && string(argv[1]) == "report") {
+        return report_main(argc - 1, argv + 1);
+    }
+    if (argc > 1 && string(argv[1]) == "diff") {
+        return diff_main(argc - 1, argv + 1);
+    }
+
     auto cli_args = CliArguments::parse(argc, argv);
     if (!cli_args.parsed) {
-        cerr << "Usage: mono-ssp --pid PID [--interval_ms 10] (--count_samples 0|--duration_sec 0) [--perf_script] [--debug]\n";
+        cerr << "Usage: mono-ssp (--pid PID [--pid PID...]|--all_mono) [--interval_ms 10] (--count_samples 0|--duration_sec 0) [--overrun skip|catch_up] [--spread] [--stats] [--stats_format text|json] [--engine ptrace|perf] [--unwinder libunwind|fp] [--jobs 1] [--snapshot] [--defer_symbols] [--perf_script|--collapsed|--collapsed_by_thread [--dump_path FILE]] [--record FILE] [--daemon DIR [--window_sec 60] [--keep_windows 60] [--max_stacks 100000] [--socket PATH]] [--debug]\n";
         return 1;
     }
 
     StringPool string_pool;
 
-    cerr << "Tracing pid " << cli_args.pid << " (debug: " << (cli_args.debug ? "true" : "false") << ") count_samples = " << cli_args.count_samples << "\n";
-
-    PerfSymbolMap symbol_map(string_pool, cli_args.pid);
-    // symbol_map.maybeAppend();
-    // uintptr_t offsets[] =  { 0x401fd040 - 1, 0x401fd040, 0x401fd040 + 1 };
-    // for (uintptr_t offset: offsets) {
-    //     auto v = symbol_map.resolve(offset);
-    //     if (v.has_value()) {
-    //         cerr << std::hex << "0x" << offset << " => " << string_pool.get_by_id(v->name_id) << "+0x" << (offset - v->offset) << std::dec << "\n";
-    //     } else {
-    //         cerr << std::hex << "0x" << offset << " => " << "-" << std::dec << "\n";
-    //     }
-    // }
-
-    // for (int i = 0; i < 20; ++i) {
-    //     auto start = std::chrono::system_clock::now();
-    //     auto res = do_fast_sample(cli_args.pid);
-
-    //     if (res.isOk()) {
-    //         cout << "do_fast_sample() OK\n";
-    //         for (auto v: res.getOkRef()) {
-    //             cout << " IP = " << std::hex << v << std::dec << "\n";
-    //         }
-    //     } else {
-    //         cerr << "do_fast_sample() failed:\n" << res.getErrRef() << "\n";
-    //     }
-    //     auto end = std::chrono::system_clock::now();
-    //     std::chrono::duration<double> elapsed_seconds = end - start;
-    //     cout << "do_fast_sample() took " << elapsed_seconds.count() << " seconds\n";
-    //     std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    // }
+    cerr << "Tracing " << (cli_args.all_mono ? "all Mono processes" : "pid");
+    for (uint32_t pid: cli_args.pids) {
+        cerr << " " << pid;
+    }
+    cerr << " (debug: " << (cli_args.debug ? "true" : "false") << ") count_samples = " << cli_args.count_samples << "\n";
+
+    uint64_t period_ns = (uint64_t) (cli_args.interval_ms * 1e6);
+    SamplingSession session(string_pool, cli_args.unwinder, cli_args.jobs, cli_args.snapshot, cli_args.defer_symbols, cli_args.spread ? period_ns : 0);
+    bool tag_processes = cli_args.all_mono || cli_args.pids.size() > 1;
+    ProcessSet processes(session, cli_args.engine, period_ns, tag_processes);
     auto sample_start_timestamp = std::chrono::steady_clock::now();
     double sample_start_ms = std::chrono::duration_cast<std::chrono::milliseconds>(sample_start_timestamp.time_since_epoch()).count() * 0.001;
 
-    uint32_t samples_count = 0;
-    while (true) {
-        auto start = std::chrono::steady_clock::now();
-        if (cli_args.count_samples > 0 && samples_count >= cli_args.count_samples) {
-            break;
+    OutputOptions output_options;
+    output_options.perf_script = cli_args.perf_script;
+    output_options.debug = cli_args.debug;
+    output_options.start_seconds = sample_start_ms;
+    output_options.collapsed = cli_args.collapsed;
+    output_options.collapsed_by_thread = cli_args.collapsed_by_thread;
+    output_options.tag_processes = tag_processes;
+    if (!cli_args.dump_path.empty()) {
+        output_options.collapsed_dump_path = cli_args.dump_path;
+    } else if (tag_processes) {
+        // Named after this mono_ssp, so that concurrent sessions do not overwrite each other.
+        output_options.collapsed_dump_path = string("/tmp/mono_ssp-all-") + std::to_string(getpid()) + ".folded";
+    } else {
+        output_options.collapsed_dump_path = string("/tmp/mono_ssp-") + std::to_string(cli_args.pids[0]) + ".folded";
+    }
+    output_options.phase_stats = &session.phase_stats;
+    std::unique_ptr<RecordWriter> record;
+    if (!cli_args.record_path.empty()) {
+        auto record_result = RecordWriter::open(cli_args.record_path, string_pool, sample_start_ms);
+        if (!record_result.isOk()) {
+            cerr << record_result.getErrRef() << "\n";
+            return 1;
+        }
+        record = move(record_result).getOkRef();
+        output_options.record = record.get();
+    }
+    std::unique_ptr<ProfileWindows> windows;
+    if (!cli_args.daemon_directory.empty()) {
+        if (mkdir(cli_args.daemon_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            cerr << "Cannot create " << cli_args.daemon_directory << ": " << strerror(errno) << "\n";
+            return 1;
         }
+        windows = std::make_unique<ProfileWindows>(string_pool, cli_args.daemon_directory, cli_args.window_seconds,
+            cli_args.keep_windows, cli_args.max_stacks, cli_args.collapsed_by_thread);
+        output_options.windows = windows.get();
+        // Stacks only go to the windows, never to stdout.
+        output_options.collapsed = false;
+    }
+    std::unique_ptr<WindowServer> window_server;
+    if (windows) {
+        auto server_result = WindowServer::start(cli_args.socket_path, *windows);
+        if (!server_result.isOk()) {
+            cerr << server_result.getErrRef() << "\n";
+            return 1;
+        }
+        window_server = move(server_result).getOkRef();
 
-        std::chrono::duration<double> current_duration = start - sample_start_timestamp;
-        if (cli_args.duration_seconds > 0 && current_duration >= std::chrono::seconds(cli_args.duration_seconds)) {
-            break;
+        // A client that disconnects early must not kill the daemon.
+        signal(SIGPIPE, SIG_IGN);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = [](int) { stop_requested.store(true); };
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+    AsyncSampleWriter writer(string_pool, output_options, OUTPUT_QUEUE_CAPACITY);
+
+    if (cli_args.collapsed && !windows) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = [](int) { request_collapsed_dump(); };
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+
+    auto print_stats = [&]() {
+        OutputBuffer out(1 << 12);
+        if (cli_args.stats_json) {
+            session.phase_stats.write_json(out);
+        } else {
+            session.phase_stats.write_text(out);
         }
-        
-        auto trace_result = sample_process(string_pool, symbol_map, cli_args.pid, cli_args.tid == 0 ? std::nullopt : std::make_optional<uintptr_t>(cli_args.tid));
-        auto end = std::chrono::steady_clock::now();
-        std::chrono::duration<double> elapsed_seconds = end - start;
-        if (cli_args.debug) {
-            cerr << "sample_process() took " << elapsed_seconds.count() << " seconds\n";
+        out.flush_to(STDERR_FILENO);
+    };
+    if (cli_args.stats) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = [](int) { request_stats_dump(); };
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, nullptr);
+    }
+
+    uint64_t tick_ns = period_ns;
+    if (cli_args.engine == Engine::Perf) {
+        // --interval_ms is the cpu-clock period; ticks only drain the rings.
+        tick_ns = std::min(std::max(period_ns * PERF_DRAIN_PERIODS, PERF_MIN_DRAIN_NS), PERF_MAX_DRAIN_NS);
+    }
+
+    for (uint32_t pid: cli_args.pids) {
+        auto add_result = processes.add(pid);
+        if (!add_result.isOk()) {
+            cerr << add_result.getErrRef() << "\n";
+            return 1;
         }
-        if (trace_result.isOk()) {
-            if (cli_args.debug) {
-                cerr << "Trace successful\n";
+    }
+    auto scan_processes = [&]() -> bool {
+        processes.remove_exited();
+        if (cli_args.all_mono) {
+            auto discover_result = processes.discover();
+            if (!discover_result.isOk()) {
+                cerr << discover_result.getErrRef() << "\n";
+                return false;
             }
-            auto process_sample = trace_result.getOkRef();
-            if (cli_args.debug) {
-                cerr << " PID = " << process_sample.pid << "\n";
+            if (cli_args.debug && discover_result.getOkRef() > 0) {
+                cerr << "Found " << discover_result.getOkRef() << " new Mono processes\n";
             }
-            for (const auto& t: process_sample.threads) {
-                if (cli_args.debug) {
-                    cerr << "  Time = " << (t.timestamp - sample_start_ms) << " TID = " << t/*.value()*/.tid << " Name = " << string_pool.get_by_id(t.thread_name_id) << "\n";
-                }
-                if (cli_args.perf_script) {
-                    cout << string_pool.get_by_id(t.thread_name_id) << " " << t.tid << " [000] " << (t.timestamp - sample_start_ms) << ": wall-clock\n";
-                }
-                for (const auto& f: t/*.value()*/.frames) {
-                    if (cli_args.debug) {
-                        cerr << "   IP = " << std::hex << f.ip << std::dec;
-                    
-                        if (f.name_id != StackFrame::NO_NAME) {
-                            cerr << " name = " << string_pool.get_by_id(f.name_id) << "+0x" << std::hex << f.name_offset << std::dec;
-                        }
-
-                        cerr << "\n";
-                    }
-                    if (cli_args.perf_script) {
-                        cout << "\t    " << std::hex << f.ip << " ";
-                        if (f.name_id == StackFrame::NO_NAME) {
-                            cout << "unknown";
-                        } else {
-                            cout << string_pool.get_by_id(f.name_id) << "+0x" << f.name_offset;
-                        }
-                        cout << " (doesn_matter.so)";
-                        cout << std::dec << "\n";
-                    }
-                }
-                if (cli_args.perf_script) {
-                    cout << "\n";
-                }
+        }
+        return true;
+    };
+    if (!scan_processes()) {
+        return 1;
+    }
+    uint64_t next_scan_ns = monotonic_now_ns() + PROCESS_SCAN_INTERVAL_NS;
+
+    auto tid = cli_args.tid == 0 ? std::nullopt : std::make_optional<uintptr_t>(cli_args.tid);
+    // Samples go to the writer and come back through writer.reuse(), so in
+    // steady state the loop below does not allocate.
+    ProcessSample sample_buffer;
+    auto handle_sample = [&](pid_t pid, const Result<bool, string>& trace_result) {
+        if (trace_result.isOk()) {
+            if (writer.submit(move(sample_buffer))) {
+                writer.reuse(sample_buffer);
             }
         } else {
             if (cli_args.debug) {
-                cerr << "Trace failed:\n" << trace_result.getErrRef() << "\n";
+                cerr << "Trace of pid " << pid << " failed:\n" << trace_result.getErrRef() << "\n";
             }
         }
+    };
 
-        int to_sleep_ms = cli_args.interval_ms - (int)(1000 * elapsed_seconds.count());
-        std::this_thread::sleep_for(std::chrono::milliseconds(to_sleep_ms));
+    SampleScheduler scheduler(tick_ns, cli_args.overrun_policy);
+    uint32_t samples_count = 0;
+    while (true) {
+        if (cli_args.count_samples > 0 && samples_count >= cli_args.count_samples) {
+            break;
+        }
+        if (stop_requested.load()) {
+            break;
+        }
+        if (processes.size() == 0 && !cli_args.all_mono) {
+            cerr << "All profiled processes exited\n";
+            break;
+        }
+
+        scheduler.wait();
+
+        std::chrono::duration<double> current_duration = std::chrono::steady_clock::now() - sample_start_timestamp;
+        if (cli_args.duration_seconds > 0 && current_duration >= std::chrono::seconds(cli_args.duration_seconds)) {
+            break;
+        }
+
+        processes.sample(tid, sample_buffer, handle_sample);
+
+        if (monotonic_now_ns() >= next_scan_ns) {
+            if (!scan_processes()) {
+                break;
+            }
+            next_scan_ns = monotonic_now_ns() + PROCESS_SCAN_INTERVAL_NS;
+        }
+
+        if (cli_args.stats && take_stats_dump_request()) {
+            print_stats();
+        }
 
         ++samples_count;
     }
 
+    writer.finish();
+
     {
         auto current_time = std::chrono::steady_clock::now();
         std::chrono::duration<double> elapsed_seconds = current_time - sample_start_timestamp;
         cerr << "Profile completed. Took " << samples_count << " process samples in " << elapsed_seconds.count() << " seconds\n";
+        if (record) {
+            cerr << "Recorded " << record->bytes_written() << " bytes to " << cli_args.record_path << "\n";
+        }
+        const auto& scheduler_stats = scheduler.stats();
+        cerr << "Scheduler: " << scheduler_stats.ticks << " ticks, " << scheduler_stats.missed_ticks << " missed ("
+            << (cli_args.overrun_policy == OverrunPolicy::Skip ? "skipped" : "taken late") << "), jitter p50 = "
+            << scheduler.jitter_percentile_us(0.5) << " us, p90 = " << scheduler.jitter_percentile_us(0.9)
+            << " us, p99 = " << scheduler.jitter_percentile_us(0.99) << " us, max = " << scheduler.max_jitter_us() << " us\n";
+        if (cli_args.engine == Engine::Perf) {
+            auto perf_stats = processes.perf_stats();
+            cerr << "perf: " << perf_stats.samples << " samples, " << perf_stats.lost << " lost\n";
+        }
+        if (cli_args.debug) {
+            auto pool_stats = string_pool.stats();
+            cerr << "String pool: " << pool_stats.strings << " strings, " << pool_stats.string_bytes << " bytes of text, "
+                << pool_stats.memory_bytes << " bytes allocated";
+            if (pool_stats.strings > 0) {
+                cerr << " (" << pool_stats.memory_bytes / pool_stats.strings << " bytes per string)";
+            }
+            cerr << "\n";
+        }
+        if (writer.dropped() > 0) {
+            cerr << "Dropped " << writer.dropped() << " process samples because output could not keep up\n";
+        }
+        if (cli_args.stats) {
+            print_stats();
+        }
     }
 
     return 0;
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <string_view>
+#include <charconv>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+// Append-only text buffer formatted with std::to_chars and written out
+// with plain write() calls, bypassing iostreams.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t reserve = 1 << 20) {
+        data.reserve(reserve);
+    }
+
+    size_t size() const { return data.size(); }
+    bool empty() const { return data.empty(); }
+    void clear() { data.clear(); }
+
+    OutputBuffer& append(std::string_view text) {
+        data.insert(data.end(), text.begin(), text.end());
+        return *this;
+    }
+
+    OutputBuffer& append(char c) {
+        data.push_back(c);
+        return *this;
+    }
+
+    OutputBuffer& append_dec(int64_t value) {
+        return append_number(value, 10);
+    }
+
+    OutputBuffer& append_hex(uint64_t value) {
+        return append_number(value, 16);
+    }
+
+    OutputBuffer& append_fixed(double value, int precision) {
+        char buffer[64];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, precision);
+        data.insert(data.end(), buffer, result.ptr);
+        return *this;
+    }
+
+    // Unsigned LEB128, used by the binary recording format.
+    OutputBuffer& append_varint(uint64_t value) {
+        while (value >= 0x80) {
+            data.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        data.push_back((char) value);
+        return *this;
+    }
+
+    OutputBuffer& append_zigzag(int64_t value) {
+        return append_varint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+    }
+
+    // Writes the whole buffer to `fd` and clears it. Returns false on write errors.
+    bool flush_to(int fd) {
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+            ssize_t rc = write(fd, p, left);
+            if (rc < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                data.clear();
+                return false;
+            }
+            p += rc;
+            left -= rc;
+        }
+        data.clear();
+        return true;
+    }
+
+private:
+    std::vector<char> data;
+
+    template <typename T>
+    OutputBuffer& append_number(T value, int base) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, base);
+        data.insert(data.end(), buffer, result.ptr);
+        return *this;
+    }
+};
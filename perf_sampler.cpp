@@ -0,0 +1,251 @@
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <asm/perf_regs.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "perf_sampler.hpp"
+
+using std::string;
+using std::to_string;
+using std::vector;
+
+// Registers are stored in the sample in ascending bit order.
+static const uint64_t SAMPLE_REGS = (1ULL << PERF_REG_X86_BP) | (1ULL << PERF_REG_X86_SP) | (1ULL << PERF_REG_X86_IP);
+static const size_t SAMPLE_REG_COUNT = 3;
+
+static string errno_message(const char* call) {
+    int errno_copy = errno;
+    return string(call) + " failed with errno = " + to_string(errno_copy) + " message = " + strerror(errno_copy);
+}
+
+PerfEventSampler::PerfEventSampler(pid_t pid, uint64_t period_ns, uint32_t stack_size)
+    : pid(pid), period_ns(period_ns), stack_size(stack_size & ~7u), page_size(sysconf(_SC_PAGESIZE)) {}
+
+PerfEventSampler::~PerfEventSampler() {
+    for (auto& entry: events) {
+        close_event(entry.second);
+    }
+}
+
+Result<bool, string> PerfEventSampler::open_event(pid_t tid, ThreadEvent& event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+    attr.sample_period = period_ns;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+    attr.sample_regs_user = SAMPLE_REGS;
+    attr.sample_stack_user = stack_size;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.use_clockid = 1;
+    attr.clockid = CLOCK_MONOTONIC;
+
+    int fd = (int) syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ESRCH) {
+            return ResultInit::ok(false);
+        }
+        string message = errno_message("perf_event_open()");
+        if (errno == EACCES || errno == EPERM) {
+            message += " (check kernel.perf_event_paranoid)";
+        }
+        return ResultInit::err(move(message));
+    }
+
+    size_t ring_size = (1 + RING_PAGES) * page_size;
+    void* ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        string message = errno_message("mmap(perf ring buffer)");
+        if (errno == EPERM) {
+            message += " (check kernel.perf_event_mlock_kb)";
+        }
+        close(fd);
+        return ResultInit::err(move(message));
+    }
+
+    event.fd = fd;
+    event.ring = static_cast<uint8_t*>(ring);
+    event.ring_size = ring_size;
+    return ResultInit::ok(true);
+}
+
+void PerfEventSampler::close_event(ThreadEvent& event) {
+    if (event.ring != nullptr) {
+        munmap(event.ring, event.ring_size);
+        event.ring = nullptr;
+    }
+    if (event.fd >= 0) {
+        close(event.fd);
+        event.fd = -1;
+    }
+}
+
+Result<bool, string> PerfEventSampler::sync_threads(const vector<uintptr_t>& tids) {
+    alive.clear();
+    for (uintptr_t tid: tids) {
+        alive.push_back((pid_t) tid);
+    }
+    std::sort(alive.begin(), alive.end());
+
+    for (auto it = events.begin(); it != events.end();) {
+        if (!std::binary_search(alive.begin(), alive.end(), it->first)) {
+            // Samples still in the ring of an exited thread are dropped.
+            close_event(it->second);
+            it = events.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (uintptr_t tid: tids) {
+        if (events.count((pid_t) tid) != 0) {
+            continue;
+        }
+        ThreadEvent event;
+        auto open_result = open_event((pid_t) tid, event);
+        if (!open_result.isOk()) {
+            return ResultInit::err(string(open_result.getErrRef()));
+        }
+        if (open_result.getOkRef()) {
+            events.emplace((pid_t) tid, event);
+        }
+    }
+
+    return ResultInit::ok(true);
+}
+
+bool PerfEventSampler::parse_sample(const uint8_t* record, size_t size, CapturedStack& sample) {
+    const uint8_t* p = record + sizeof(struct perf_event_header);
+    const uint8_t* end = record + size;
+
+    auto read_u64 = [&](uint64_t& value) {
+        if (end - p < (ptrdiff_t) sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return true;
+    };
+
+    // PERF_SAMPLE_TID: u32 pid, u32 tid
+    uint64_t pid_tid;
+    if (!read_u64(pid_tid)) {
+        return false;
+    }
+    sample.tid = (pid_t) (pid_tid >> 32);
+
+    if (!read_u64(sample.time_ns)) {
+        return false;
+    }
+
+    uint64_t abi;
+    if (!read_u64(abi)) {
+        return false;
+    }
+    if (abi == PERF_SAMPLE_REGS_ABI_NONE) {
+        ++stats_.no_user_regs;
+        return false;
+    }
+    uint64_t regs[SAMPLE_REG_COUNT];
+    for (auto& reg: regs) {
+        if (!read_u64(reg)) {
+            return false;
+        }
+    }
+    sample.bp = regs[0];
+    sample.sp = regs[1];
+    sample.ip = regs[2];
+
+    // PERF_SAMPLE_STACK_USER: u64 size, char data[size], u64 dyn_size
+    uint64_t captured_size;
+    if (!read_u64(captured_size)) {
+        return false;
+    }
+    sample.stack = p;
+    sample.stack_size = 0;
+    if (captured_size != 0) {
+        if ((uint64_t) (end - p) < captured_size + sizeof(uint64_t)) {
+            return false;
+        }
+        p += captured_size;
+        uint64_t dyn_size;
+        read_u64(dyn_size);
+        sample.stack_size = dyn_size < captured_size ? dyn_size : captured_size;
+    }
+
+    return true;
+}
+
+size_t PerfEventSampler::drain_event(ThreadEvent& event, FunctionRef<void(const CapturedStack&)> fn) {
+    auto* header = reinterpret_cast<struct perf_event_mmap_page*>(event.ring);
+    const uint8_t* data = event.ring + page_size;
+    uint64_t data_size = RING_PAGES * page_size;
+
+    uint64_t head = __atomic_load_n(&header->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = header->data_tail;
+    size_t count = 0;
+
+    while (tail + sizeof(struct perf_event_header) <= head) {
+        size_t offset = tail & (data_size - 1);
+        struct perf_event_header record_header;
+        if (offset + sizeof(record_header) <= data_size) {
+            memcpy(&record_header, data + offset, sizeof(record_header));
+        } else {
+            size_t first = data_size - offset;
+            memcpy(&record_header, data + offset, first);
+            memcpy(reinterpret_cast<uint8_t*>(&record_header) + first, data, sizeof(record_header) - first);
+        }
+        if (record_header.size < sizeof(record_header) || tail + record_header.size > head) {
+            break;
+        }
+
+        const uint8_t* record = data + offset;
+        if (offset + record_header.size > data_size) {
+            record_buffer.resize(record_header.size);
+            size_t first = data_size - offset;
+            memcpy(record_buffer.data(), data + offset, first);
+            memcpy(record_buffer.data() + first, data, record_header.size - first);
+            record = record_buffer.data();
+        }
+
+        if (record_header.type == PERF_RECORD_SAMPLE) {
+            CapturedStack sample;
+            if (parse_sample(record, record_header.size, sample)) {
+                ++stats_.samples;
+                ++count;
+                fn(sample);
+            }
+        } else if (record_header.type == PERF_RECORD_LOST) {
+            // struct { header; u64 id; u64 lost; }
+            uint64_t lost;
+            if (record_header.size >= sizeof(record_header) + 2 * sizeof(uint64_t)) {
+                memcpy(&lost, record + sizeof(record_header) + sizeof(uint64_t), sizeof(lost));
+                stats_.lost += lost;
+            }
+        }
+
+        tail += record_header.size;
+    }
+
+    __atomic_store_n(&header->data_tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+size_t PerfEventSampler::drain(FunctionRef<void(const CapturedStack&)> fn) {
+    size_t count = 0;
+    for (auto& entry: events) {
+        count += drain_event(entry.second, fn);
+    }
+    return count;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "result.hpp"
+#include "function_ref.hpp"
+
+// One PERF_RECORD_SAMPLE: user registers and the top of the user stack,
+// copied by the kernel at the moment the cpu-clock timer fired.
+struct CapturedStack {
+    pid_t tid;
+    // CLOCK_MONOTONIC.
+    uint64_t time_ns;
+    uint64_t ip;
+    uint64_t sp;
+    uint64_t bp;
+    // Stack bytes starting at sp; only valid during the drain() callback.
+    const uint8_t* stack;
+    size_t stack_size;
+};
+
+// Non-stopping sampler: a per-thread cpu-clock perf event with
+// PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER. The target is never
+// interrupted; its stacks are unwound offline from the captured copies.
+//
+// Only on-CPU time is observed, so blocked threads produce no samples.
+// Unprivileged use is limited by kernel.perf_event_paranoid and by
+// kernel.perf_event_mlock_kb (RING_PAGES per thread).
+class PerfEventSampler {
+public:
+    // Data pages of every ring buffer; must be a power of two.
+    static const size_t RING_PAGES = 32;
+    static const uint32_t DEFAULT_STACK_SIZE = 8192;
+
+    struct Stats {
+        uint64_t samples = 0;
+        // Samples the kernel dropped because a ring buffer was full.
+        uint64_t lost = 0;
+        // Samples taken without user registers (e.g. in a kernel thread).
+        uint64_t no_user_regs = 0;
+    };
+
+    PerfEventSampler(pid_t pid, uint64_t period_ns, uint32_t stack_size = DEFAULT_STACK_SIZE);
+    PerfEventSampler(const PerfEventSampler&) = delete;
+    ~PerfEventSampler();
+
+    // Opens events for new threads in `tids` and closes those of threads
+    // that are gone. Threads that exit before their event is opened are skipped.
+    Result<bool, std::string> sync_threads(const std::vector<uintptr_t>& tids);
+
+    // Calls fn for every sample collected since the previous drain().
+    size_t drain(FunctionRef<void(const CapturedStack&)> fn);
+
+    size_t threads() const { return events.size(); }
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct ThreadEvent {
+        int fd = -1;
+        uint8_t* ring = nullptr;
+        size_t ring_size = 0;
+    };
+
+    pid_t pid;
+    uint64_t period_ns;
+    uint32_t stack_size;
+    size_t page_size;
+    std::unordered_map<pid_t, ThreadEvent> events;
+    // Records that wrap around the end of a ring are copied here.
+    std::vector<uint8_t> record_buffer;
+    // Sorted copy of the tids passed to sync_threads(), kept between calls.
+    std::vector<pid_t> alive;
+    Stats stats_;
+
+    Result<bool, std::string> open_event(pid_t tid, ThreadEvent& event);
+    void close_event(ThreadEvent& event);
+    size_t drain_event(ThreadEvent& event, FunctionRef<void(const CapturedStack&)> fn);
+    bool parse_sample(const uint8_t* record, size_t size, CapturedStack& sample);
+};
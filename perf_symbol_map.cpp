@@ -0,0 +1,255 @@
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "perf_symbol_map.hpp"
+
+using std::string;
+using std::vector;
+
+static const size_t READ_CHUNK_SIZE = 1 << 20;
+
+PerfSymbolMap::PerfSymbolMap(StringPool& string_pool, uintptr_t pid) : string_pool(string_pool) {
+    path = std::string("/tmp/perf-") + std::to_string(pid) + ".map";
+    path_id = string_pool.intern(path);
+    eytzinger.resize(1);
+    eytzinger_index.resize(1);
+}
+
+PerfSymbolMap::~PerfSymbolMap() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+// Parses a hex number without "0x"; returns nullptr if there are no digits.
+static const char* parse_hex(const char* p, const char* end, uintptr_t& value) {
+    const char* start = p;
+    value = 0;
+    for (; p < end; ++p) {
+        char c = *p;
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            break;
+        }
+        value = (value << 4) | digit;
+    }
+    return p == start ? nullptr : p;
+}
+
+void PerfSymbolMap::parse_lines(const char* begin, const char* end, vector<PerfSymbolInfo>& out) {
+    // "START SIZE name\n", hex without 0x
+    const char* line = begin;
+    while (line < end) {
+        const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (line_end == nullptr) {
+            line_end = end;
+        }
+
+        uintptr_t offset, length;
+        const char* p = parse_hex(line, line_end, offset);
+        if (p != nullptr && p < line_end && *p == ' ') {
+            p = parse_hex(p + 1, line_end, length);
+            if (p != nullptr && p < line_end && *p == ' ') {
+                uint64_t name_id = string_pool.intern(std::string_view(p + 1, line_end - (p + 1)));
+                out.push_back(PerfSymbolInfo { offset, length, name_id });
+            }
+        }
+
+        line = line_end + 1;
+    }
+}
+
+void PerfSymbolMap::maybeAppend() {
+    appended_.clear();
+    if (fd < 0) {
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+    }
+
+    size_t pending_before = pending.size();
+    vector<char>& buffer = read_buffer;
+    buffer.resize(READ_CHUNK_SIZE);
+    while (true) {
+        ssize_t rc = pread(fd, buffer.data(), buffer.size(), last_length);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            break;
+        }
+        last_length += rc;
+
+        const char* begin = buffer.data();
+        const char* end = begin + rc;
+        const char* last_newline = begin + rc;
+        while (last_newline > begin && last_newline[-1] != '\n') {
+            --last_newline;
+        }
+
+        if (last_newline == begin) {
+            // no complete line in this chunk
+            partial_line.append(begin, end);
+            continue;
+        }
+
+        if (!partial_line.empty()) {
+            const char* first_newline = static_cast<const char*>(memchr(begin, '\n', rc));
+            partial_line.append(begin, first_newline + 1);
+            parse_lines(partial_line.data(), partial_line.data() + partial_line.size(), pending);
+            partial_line.clear();
+            begin = first_newline + 1;
+        }
+
+        parse_lines(begin, last_newline, pending);
+        partial_line.assign(last_newline, end);
+    }
+
+    if (pending.size() == pending_before) {
+        return;
+    }
+
+    appended_.assign(pending.begin() + pending_before, pending.end());
+    if (pending.size() >= MERGE_THRESHOLD || symbols.empty()) {
+        merge_pending();
+    } else {
+        normalize_symbols(pending);
+    }
+}
+
+void normalize_symbols(vector<PerfSymbolInfo>& entries) {
+    // Remember the original (age) order, then sort by address.
+    vector<std::pair<PerfSymbolInfo, size_t>> ordered;
+    ordered.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        ordered.emplace_back(entries[i], i);
+    }
+    std::stable_sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) {
+        return a.first.offset < b.first.offset;
+    });
+
+    vector<std::pair<PerfSymbolInfo, size_t>> result;
+    result.reserve(ordered.size());
+    for (const auto& candidate: ordered) {
+        bool keep = true;
+        while (!result.empty()) {
+            const auto& last = result.back();
+            bool overlaps = last.first.offset + last.first.length > candidate.first.offset;
+            if (!overlaps) {
+                break;
+            }
+            if (candidate.second > last.second) {
+                result.pop_back();
+            } else {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            result.push_back(candidate);
+        }
+    }
+
+    entries.clear();
+    for (const auto& entry: result) {
+        entries.push_back(entry.first);
+    }
+}
+
+void PerfSymbolMap::merge_pending() {
+    // `symbols` is older than everything in `pending`.
+    symbols.insert(symbols.end(), pending.begin(), pending.end());
+    pending.clear();
+    normalize_symbols(symbols);
+    build_eytzinger();
+}
+
+void PerfSymbolMap::build_eytzinger() {
+    size_t n = symbols.size();
+    eytzinger.assign(n + 1, 0);
+    eytzinger_index.assign(n + 1, 0);
+
+    // In-order traversal of the implicit tree assigns sorted elements.
+    size_t next = 0;
+    vector<size_t> stack;
+    size_t k = 1;
+    while (k <= n || !stack.empty()) {
+        while (k <= n) {
+            stack.push_back(k);
+            k = 2 * k;
+        }
+        k = stack.back();
+        stack.pop_back();
+        eytzinger[k] = symbols[next].offset;
+        eytzinger_index[k] = next;
+        ++next;
+        k = 2 * k + 1;
+    }
+}
+
+static std::optional<PerfSymbolInfo> check_symbol(const PerfSymbolInfo& symbol, uintptr_t offset) {
+    if (symbol.offset <= offset && offset < symbol.offset + symbol.length) {
+        return symbol;
+    }
+    return std::nullopt;
+}
+
+std::optional<PerfSymbolInfo> PerfSymbolMap::resolve(uintptr_t offset) const {
+    // Newer symbols first: they may have replaced older code at this address.
+    if (!pending.empty()) {
+        auto it = std::upper_bound(pending.begin(), pending.end(), offset, [](uintptr_t value, const PerfSymbolInfo& symbol) {
+            return value < symbol.offset;
+        });
+        if (it != pending.begin()) {
+            auto symbol = check_symbol(*(it - 1), offset);
+            if (symbol.has_value()) {
+                return symbol;
+            }
+        }
+    }
+
+    size_t n = symbols.size();
+    if (n == 0) {
+        return std::nullopt;
+    }
+
+    // Branch-free descent to the first start address > offset.
+    size_t k = 1;
+    while (k <= n) {
+        k = 2 * k + (eytzinger[k] <= offset);
+    }
+    k >>= __builtin_ffsll(~k);
+
+    size_t upper = k == 0 ? n : eytzinger_index[k];
+    if (upper == 0) {
+        return std::nullopt;
+    }
+
+    const PerfSymbolInfo& symbol = symbols[upper - 1];
+    auto result = check_symbol(symbol, offset);
+    if (result.has_value() && !pending.empty()) {
+        // An older symbol that a pending one partially overlaps is stale.
+        auto it = std::upper_bound(pending.begin(), pending.end(), symbol.offset + symbol.length - 1, [](uintptr_t value, const PerfSymbolInfo& p) {
+            return value < p.offset;
+        });
+        if (it != pending.begin() && (it - 1)->offset + (it - 1)->length > symbol.offset) {
+            return std::nullopt;
+        }
+    }
+    return result;
+}
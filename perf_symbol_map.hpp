@@ -1,14 +1,11 @@
 #pragma once
 
 #include <string>
-#include <map>
-#include <iostream>
-#include <fstream>
+#include <vector>
+#include <optional>
+#include <stdint.h>
 
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
 
 #include "stringpool.hpp"
 
@@ -18,55 +15,57 @@ struct PerfSymbolInfo {
     uint64_t name_id;
 };
 
+// JIT symbols from /tmp/perf-PID.map (written by `mono --jitmap`).
+//
+// Symbols are kept in a flat array sorted by address, searched through an
+// Eytzinger-ordered copy of the start addresses. New lines are collected in
+// a small sorted `pending` batch that is searched first and merged into the
+// main array once it grows past MERGE_THRESHOLD. When Mono re-JITs code into
+// an address range that is already mapped, the newer symbol replaces the
+// older ones it overlaps.
+//
+// resolve() may be called concurrently; maybeAppend() must not run at the
+// same time as resolve().
 struct PerfSymbolMap {
+    static const size_t MERGE_THRESHOLD = 4096;
+
     StringPool& string_pool;
     std::string path;
-    uint64_t last_length = 0;
-    std::map<uintptr_t, PerfSymbolInfo> symbols;
+    // Module name of JIT frames, as `perf script` prints it.
+    uint64_t path_id;
 
-    PerfSymbolMap(StringPool& string_pool, uintptr_t pid) : string_pool(string_pool) {
-        path = std::string("/tmp/perf-") + std::to_string(pid) + ".map";
-    }
+    PerfSymbolMap(StringPool& string_pool, uintptr_t pid);
+    PerfSymbolMap(const PerfSymbolMap&) = delete;
+    ~PerfSymbolMap();
 
-    void maybeAppend() {
-        struct stat statbuf;
-        int rc = lstat(path.c_str(), &statbuf);
-        // std::cerr << "lstat(" << path << ") = " << rc << "\n";
-        if (rc != 0) {
-            return;
-        }
-        uintptr_t file_size = statbuf.st_size;
-        // std::cerr << "file_size = " << file_size << ", last_length = " << last_length << "\n";
-        if (last_length < file_size) {
-            std::ifstream in(path.c_str());
-            in.seekg(last_length);
-            in >> std::hex;
-            uintptr_t offset, length;
-            while (in >> offset >> length) {
-                std::string name;
-                in.ignore(1, ' ');
-                std::getline(in, name);
-                uint64_t name_id = string_pool.intern(name);
-                // std::cerr << "got off=" << std::hex << offset << " len=" << length << " name='" << name << "'\n" << std::dec;
-                symbols[offset] = PerfSymbolInfo { offset, length, name_id };
-            }
+    // Reads lines appended to the map file since the previous call.
+    void maybeAppend();
+    std::optional<PerfSymbolInfo> resolve(uintptr_t offset) const;
 
-            last_length = file_size;
-        }
-    }
+    size_t size() const { return symbols.size() + pending.size(); }
+    // Symbols read by the last maybeAppend(), in file order.
+    const std::vector<PerfSymbolInfo>& appended() const { return appended_; }
 
-    std::optional<PerfSymbolInfo> resolve(uintptr_t offset) {
-        if (symbols.empty()) {
-            return std::nullopt;
-        }
+private:
+    int fd = -1;
+    uint64_t last_length = 0;
+    // Bytes of an incomplete last line, kept until its newline arrives.
+    std::string partial_line;
+    // Kept between calls, so polling an unchanged map does not allocate.
+    std::vector<char> read_buffer;
+    std::vector<PerfSymbolInfo> symbols;
+    // symbols[i].offset in Eytzinger (BFS) order, 1-based; eytzinger_index
+    // maps every position back to its index in `symbols`.
+    std::vector<uintptr_t> eytzinger;
+    std::vector<uint32_t> eytzinger_index;
+    std::vector<PerfSymbolInfo> pending;
+    std::vector<PerfSymbolInfo> appended_;
 
-        auto it = symbols.upper_bound(offset);
-        --it;
-        const auto& symbol = it->second;
-        if (symbol.offset <= offset && offset < symbol.offset + symbol.length) {
-            return symbol;
-        } else {
-            return std::nullopt;
-        }
-    }
+    void parse_lines(const char* begin, const char* end, std::vector<PerfSymbolInfo>& out);
+    void merge_pending();
+    void build_eytzinger();
 };
+
+// Sorts `entries` (given oldest first) by address and drops entries that
+// overlap a newer one.
+void normalize_symbols(std::vector<PerfSymbolInfo>& entries);
@@ -0,0 +1,133 @@
+#include <stdio.h>
+
+#include "phase_stats.hpp"
+
+static std::atomic<bool> stats_dump_requested { false };
+
+void request_stats_dump() {
+    stats_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+bool take_stats_dump_request() {
+    return stats_dump_requested.exchange(false, std::memory_order_relaxed);
+}
+
+const char* phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::Tick: return "tick";
+        case Phase::RefreshMaps: return "refresh_maps";
+        case Phase::ListThreads: return "list_threads";
+        case Phase::ReadState: return "read_state";
+        case Phase::Interrupt: return "interrupt";
+        case Phase::Wait: return "wait";
+        case Phase::ReadName: return "read_name";
+        case Phase::GetRegisters: return "get_registers";
+        case Phase::Unwind: return "unwind";
+        case Phase::Symbolize: return "symbolize";
+        case Phase::Release: return "release";
+        case Phase::ThreadStopped: return "thread_stopped";
+        case Phase::Output: return "output";
+        case Phase::Count: break;
+    }
+    return "unknown";
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t nanoseconds) {
+    if (nanoseconds < 16) {
+        return nanoseconds;
+    }
+    size_t exponent = 63 - __builtin_clzll(nanoseconds);
+    size_t sub_bucket = (nanoseconds >> (exponent - 3)) & (SUB_BUCKETS - 1);
+    return 16 + (exponent - 4) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+    size_t exponent = (bucket - 16) / SUB_BUCKETS + 4;
+    size_t sub_bucket = (bucket - 16) % SUB_BUCKETS;
+    uint64_t width = 1ull << (exponent - 3);
+    return (1ull << exponent) + (sub_bucket + 1) * width - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    buckets[bucket_of(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while (nanoseconds > current && !max_.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket: buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    uint64_t rank = (uint64_t) (q * count() + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < max() ? bound : max();
+        }
+    }
+    return max();
+}
+
+static const double PERCENTILES[] = { 0.5, 0.9, 0.99 };
+static const char* PERCENTILE_NAMES[] = { "p50", "p90", "p99" };
+
+void PhaseStats::write_text(OutputBuffer& out) const {
+    char line[160];
+    snprintf(line, sizeof(line), "%-16s %10s %11s %11s %11s %11s %11s\n", "phase", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+    out.append(line);
+    for (size_t i = 0; i < (size_t) Phase::Count; ++i) {
+        const LatencyHistogram& h = histograms[i];
+        if (h.count() == 0) {
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "%-16s %10llu %11.1f %11.1f %11.1f %11.1f %11.1f\n", phase_name((Phase) i),
+            (unsigned long long) h.count(), h.sum() * 1e-3 / h.count(),
+            h.percentile(PERCENTILES[0]) * 1e-3, h.percentile(PERCENTILES[1]) * 1e-3, h.percentile(PERCENTILES[2]) * 1e-3,
+            h.max() * 1e-3);
+        out.append(line);
+    }
+}
+
+void PhaseStats::write_json(OutputBuffer& out) const {
+    out.append("{\"phases\":{");
+    bool first = true;
+    for (size_t i = 0; i < (size_t) Phase::Count; ++i) {
+        const LatencyHistogram& h = histograms[i];
+        if (h.count() == 0) {
+            continue;
+        }
+        if (!first) {
+            out.append(',');
+        }
+        first = false;
+
+        out.append('"').append(phase_name((Phase) i)).append("\":{")
+            .append("\"count\":").append_dec(h.count())
+            .append(",\"sum_ns\":").append_dec(h.sum());
+        for (size_t p = 0; p < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); ++p) {
+            out.append(",\"").append(PERCENTILE_NAMES[p]).append("_ns\":").append_dec(h.percentile(PERCENTILES[p]));
+        }
+        out.append(",\"max_ns\":").append_dec(h.max()).append('}');
+    }
+    out.append("}}\n");
+}
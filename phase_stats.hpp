@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "output_buffer.hpp"
+
+// Stages of taking and writing out a sample, timed separately for --stats.
+enum class Phase {
+    // Whole sample_process() call.
+    Tick,
+    // Perf map, /proc/<pid>/maps and ELF module updates.
+    RefreshMaps,
+    // Listing /proc/<pid>/task.
+    ListThreads,
+    // /proc/<tid>/stat and wchan.
+    ReadState,
+    // PTRACE_SEIZE + PTRACE_INTERRUPT.
+    Interrupt,
+    // waitpid() for the stop.
+    Wait,
+    // /proc/<tid>/comm.
+    ReadName,
+    // PTRACE_GETREGS.
+    GetRegisters,
+    // Stack walk, without symbolization.
+    Unwind,
+    // Frame name lookups of one thread (or of a whole tick with --defer_symbols).
+    Symbolize,
+    // PTRACE_DETACH.
+    Release,
+    // From interrupt to release: how long the thread was held.
+    ThreadStopped,
+    // Formatting and writing one process sample.
+    Output,
+    Count,
+};
+
+const char* phase_name(Phase phase);
+
+// Histogram of durations in nanoseconds with logarithmic buckets: exact
+// below 16 ns, then 8 buckets per power of two (at most 12.5% error).
+// record() may be called from several threads at once.
+class LatencyHistogram {
+public:
+    static const size_t SUB_BUCKETS = 8;
+    static const size_t BUCKETS = 16 + (64 - 4) * SUB_BUCKETS;
+
+    void record(uint64_t nanoseconds);
+    // Not safe to call concurrently with record().
+    void reset();
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the q-th quantile, 0 < q <= 1.
+    uint64_t percentile(double q) const;
+
+    static size_t bucket_of(uint64_t nanoseconds);
+    static uint64_t bucket_upper_bound(size_t bucket);
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> count_ { 0 };
+    std::atomic<uint64_t> sum_ { 0 };
+    std::atomic<uint64_t> max_ { 0 };
+};
+
+class PhaseStats {
+public:
+    void record(Phase phase, uint64_t nanoseconds) {
+        histograms[(size_t) phase].record(nanoseconds);
+    }
+    const LatencyHistogram& histogram(Phase phase) const {
+        return histograms[(size_t) phase];
+    }
+    void reset() {
+        for (auto& h: histograms) {
+            h.reset();
+        }
+    }
+
+    // One line per phase that has samples, times in microseconds.
+    void write_text(OutputBuffer& out) const;
+    void write_json(OutputBuffer& out) const;
+
+private:
+    LatencyHistogram histograms[(size_t) Phase::Count];
+};
+
+// Records the time from construction to stop() (or destruction) into `stats`.
+class PhaseTimer {
+public:
+    PhaseTimer(PhaseStats& stats, Phase phase)
+        : stats(stats), phase(phase), started_at(std::chrono::steady_clock::now()) {}
+    PhaseTimer(const PhaseTimer&) = delete;
+    ~PhaseTimer() {
+        stop();
+    }
+
+    // Returns the measured duration in nanoseconds.
+    uint64_t stop() {
+        if (stopped) {
+            return 0;
+        }
+        stopped = true;
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started_at).count();
+        stats.record(phase, elapsed);
+        return elapsed;
+    }
+
+private:
+    PhaseStats& stats;
+    Phase phase;
+    std::chrono::steady_clock::time_point started_at;
+    bool stopped = false;
+};
+
+// Asks the sampling loop to print --stats now. Async-signal-safe.
+void request_stats_dump();
+// Returns true (once) if request_stats_dump() was called since the last check.
+bool take_stats_dump_request();
@@ -0,0 +1,126 @@
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "proc_maps.hpp"
+
+using std::string;
+using std::to_string;
+using std::move;
+using std::vector;
+
+vector<MemoryMapping> parse_proc_maps(const string& content) {
+    vector<MemoryMapping> result;
+
+    size_t line_start = 0;
+    while (line_start < content.size()) {
+        size_t line_end = content.find('\n', line_start);
+        if (line_end == string::npos) {
+            line_end = content.size();
+        }
+
+        // start-end perms offset dev inode [path]
+        const char* p = content.c_str() + line_start;
+        char* next;
+        MemoryMapping mapping;
+        mapping.start = strtoull(p, &next, 16);
+        mapping.end = strtoull(next + 1, &next, 16);
+        mapping.executable = next[1] != '\0' && next[3] == 'x';
+        p = strchr(next + 1, ' ');
+        if (p != nullptr && p < content.c_str() + line_end) {
+            mapping.file_offset = strtoull(p + 1, &next, 16);
+            // "major:minor", in hex
+            uint64_t major = strtoull(next + 1, &next, 16);
+            uint64_t minor = *next == ':' ? strtoull(next + 1, &next, 16) : 0;
+            mapping.device = (major << 32) | minor;
+            p = strchr(next, ' ');
+            mapping.inode = p ? strtoull(p + 1, &next, 10) : 0;
+            const char* path_start = next;
+            const char* line_end_ptr = content.c_str() + line_end;
+            while (path_start < line_end_ptr && *path_start == ' ') {
+                ++path_start;
+            }
+            mapping.path.assign(path_start, line_end_ptr);
+            result.push_back(move(mapping));
+        }
+
+        line_start = line_end + 1;
+    }
+
+    return result;
+}
+
+const MemoryMapping* find_mapping(const std::vector<MemoryMapping>& mappings, uintptr_t address) {
+    auto it = std::upper_bound(mappings.begin(), mappings.end(), address, [](uintptr_t value, const MemoryMapping& mapping) {
+        return value < mapping.start;
+    });
+    if (it == mappings.begin()) {
+        return nullptr;
+    }
+    --it;
+    return address < it->end ? &*it : nullptr;
+}
+
+ProcMapsWatcher::ProcMapsWatcher(pid_t pid) : pid(pid) {}
+
+ProcMapsWatcher::~ProcMapsWatcher() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+Result<bool, string> ProcMapsWatcher::refresh(vector<MemoryMapping>& removed) {
+    if (fd < 0) {
+        string path = string("/proc/") + to_string(pid) + "/maps";
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return ResultInit::err(string("open(") + path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+        }
+    }
+
+    std::swap(content, previous_content);
+    content.clear();
+    char buffer[16384];
+    off_t offset = 0;
+    while (true) {
+        ssize_t rc = pread(fd, buffer, sizeof(buffer), offset);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ResultInit::err(string("pread(/proc/") + to_string(pid) + "/maps) failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+        }
+        if (rc == 0) {
+            break;
+        }
+        content.append(buffer, rc);
+        offset += rc;
+    }
+
+    if (content == previous_content) {
+        return ResultInit::ok(false);
+    }
+
+    vector<MemoryMapping> current = parse_proc_maps(content);
+    // Both lists are sorted by start address.
+    auto it = current.begin();
+    for (const auto& old_mapping: mappings_) {
+        while (it != current.end() && it->start < old_mapping.start) {
+            ++it;
+        }
+        if (it == current.end() || !(*it == old_mapping)) {
+            removed.push_back(old_mapping);
+        }
+    }
+
+    mappings_ = move(current);
+    ++generation_;
+    return ResultInit::ok(true);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "result.hpp"
+
+struct MemoryMapping {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t file_offset;
+    // major << 32 | minor of the device holding the file.
+    uint64_t device;
+    uint64_t inode;
+    bool executable;
+    std::string path;
+
+    bool operator==(const MemoryMapping& other) const {
+        return start == other.start && end == other.end && file_offset == other.file_offset
+            && device == other.device && inode == other.inode && executable == other.executable && path == other.path;
+    }
+};
+
+std::vector<MemoryMapping> parse_proc_maps(const std::string& content);
+// `mappings` must be sorted by address, as /proc/<pid>/maps is.
+const MemoryMapping* find_mapping(const std::vector<MemoryMapping>& mappings, uintptr_t address);
+
+// Keeps /proc/<pid>/maps open and re-reads it with pread(). refresh() reports
+// the mappings that disappeared or changed since the previous call, so that
+// caches keyed by address can be invalidated per mapping.
+class ProcMapsWatcher {
+public:
+    explicit ProcMapsWatcher(pid_t pid);
+    ProcMapsWatcher(const ProcMapsWatcher&) = delete;
+    ~ProcMapsWatcher();
+
+    // Returns true if the maps changed; `removed` receives stale mappings.
+    Result<bool, std::string> refresh(std::vector<MemoryMapping>& removed);
+
+    const std::vector<MemoryMapping>& mappings() const { return mappings_; }
+    // Incremented on every observed change.
+    uint64_t generation() const { return generation_; }
+
+private:
+    pid_t pid;
+    int fd = -1;
+    std::string content;
+    std::string previous_content;
+    std::vector<MemoryMapping> mappings_;
+    uint64_t generation_ = 0;
+};
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "process_set.hpp"
+#include "scheduler.hpp"
+
+using std::string;
+using std::to_string;
+using std::vector;
+using std::move;
+
+static string read_comm(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/comm", (int) pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return string();
+    }
+    char buffer[64];
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (length <= 0) {
+        return string();
+    }
+    string comm(buffer, length);
+    if (comm.back() == '\n') {
+        comm.pop_back();
+    }
+    return comm;
+}
+
+bool process_exited(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return true;
+    }
+    char buffer[512];
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) {
+        return true;
+    }
+    buffer[length] = '\0';
+
+    // "pid (comm) S ..." where comm itself may contain ')'
+    const char* comm_end = strrchr(buffer, ')');
+    if (comm_end == nullptr || comm_end[1] != ' ') {
+        return true;
+    }
+    return comm_end[2] == 'Z' || comm_end[2] == 'X';
+}
+
+ProfiledProcess::ProfiledProcess(SamplingSession& session, pid_t pid)
+    : symbol_map(session.string_pool, pid), context(session, symbol_map, pid) {
+    tag_id = session.string_pool.intern(read_comm(pid) + " (" + to_string(pid) + ")");
+}
+
+ProcessSet::ProcessSet(SamplingSession& session, Engine engine, uint64_t period_ns, bool tag_processes)
+    : session(session), engine(engine), period_ns(period_ns), tag_processes(tag_processes) {}
+
+Result<bool, string> ProcessSet::add(pid_t pid) {
+    for (const auto& process: processes) {
+        if ((pid_t) process->context.pid == pid) {
+            return ResultInit::ok(false);
+        }
+    }
+
+    auto process = std::make_unique<ProfiledProcess>(session, pid);
+    if (engine == Engine::Perf) {
+        process->perf_sampler = std::make_unique<PerfEventSampler>(pid, period_ns);
+        // Opens the events, so that missing permissions are reported up front.
+        ProcessSample discarded;
+        auto open_result = sample_perf_events(process->context, *process->perf_sampler, std::nullopt, discarded);
+        if (!open_result.isOk()) {
+            return ResultInit::err(string("pid ") + to_string(pid) + ": " + open_result.getErrRef());
+        }
+    }
+
+    processes.push_back(move(process));
+    return ResultInit::ok(true);
+}
+
+Result<size_t, string> ProcessSet::discover() {
+    DIR* dir = opendir("/tmp");
+    if (dir == nullptr) {
+        int errno_copy = errno;
+        return ResultInit::err(string("opendir(/tmp) failed: errno = ") + to_string(errno_copy) + " message = " + strerror(errno_copy));
+    }
+
+    vector<pid_t> candidates;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        int pid;
+        int consumed = 0;
+        // "perf-<pid>.map", as written by mono --jitmap
+        if (sscanf(entry->d_name, "perf-%d.map%n", &pid, &consumed) == 1 && entry->d_name[consumed] == '\0' && pid > 0) {
+            candidates.push_back(pid);
+        }
+    }
+    closedir(dir);
+
+    // A new process may get the pid of a skipped one that exited.
+    skipped.erase(std::remove_if(skipped.begin(), skipped.end(), process_exited), skipped.end());
+
+    size_t added = 0;
+    pid_t self = getpid();
+    for (pid_t pid: candidates) {
+        // Maps of processes that exited are left behind in /tmp.
+        if (pid == self || process_exited(pid) || std::find(skipped.begin(), skipped.end(), pid) != skipped.end()) {
+            continue;
+        }
+        auto add_result = add(pid);
+        if (!add_result.isOk()) {
+            std::cerr << "Skipping " << add_result.getErrRef() << "\n";
+            skipped.push_back(pid);
+            continue;
+        }
+        if (add_result.getOkRef()) {
+            ++added;
+        }
+    }
+
+    return ResultInit::ok(move(added));
+}
+
+static void add_perf_stats(PerfEventSampler::Stats& total, const PerfEventSampler::Stats& stats) {
+    total.samples += stats.samples;
+    total.lost += stats.lost;
+    total.no_user_regs += stats.no_user_regs;
+}
+
+void ProcessSet::remove_exited() {
+    processes.erase(std::remove_if(processes.begin(), processes.end(), [&](const std::unique_ptr<ProfiledProcess>& process) {
+        if (!process_exited((pid_t) process->context.pid)) {
+            return false;
+        }
+        if (process->perf_sampler) {
+            add_perf_stats(exited_perf_stats, process->perf_sampler->stats());
+        }
+        return true;
+    }), processes.end());
+}
+
+void ProcessSet::sample(std::optional<uintptr_t> tid, ProcessSample& buffer, FunctionRef<void(pid_t, const Result<bool, string>&)> fn) {
+    // With --spread the processes, sampled one after another, share the
+    // interval instead of each taking all of it.
+    uint64_t tick_start_ns = monotonic_now_ns();
+    size_t index = 0;
+    bool exited = false;
+    for (auto& process: processes) {
+        if (session.spread_ns != 0) {
+            process->context.spread_ns = session.spread_ns / processes.size();
+            process->context.spread_start_ns = tick_start_ns + session.spread_ns * index / processes.size();
+        }
+        ++index;
+        auto sample_result = process->perf_sampler
+            ? sample_perf_events(process->context, *process->perf_sampler, tid, buffer)
+            : sample_process(process->context, tid, buffer);
+        if (!sample_result.isOk() && process_exited((pid_t) process->context.pid)) {
+            // Not an error; remove_exited() forgets it.
+            exited = true;
+            continue;
+        }
+        if (sample_result.isOk() && tag_processes) {
+            buffer.process_tag_id = process->tag_id;
+        }
+        fn((pid_t) process->context.pid, sample_result);
+    }
+
+    if (exited) {
+        remove_exited();
+    }
+}
+
+vector<pid_t> ProcessSet::pids() const {
+    vector<pid_t> result;
+    for (const auto& process: processes) {
+        result.push_back((pid_t) process->context.pid);
+    }
+    return result;
+}
+
+PerfEventSampler::Stats ProcessSet::perf_stats() const {
+    PerfEventSampler::Stats total = exited_perf_stats;
+    for (const auto& process: processes) {
+        if (process->perf_sampler) {
+            add_perf_stats(total, process->perf_sampler->stats());
+        }
+    }
+    return total;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <optional>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "result.hpp"
+#include "backtrace.hpp"
+#include "perf_symbol_map.hpp"
+#include "perf_sampler.hpp"
+#include "function_ref.hpp"
+
+// One profiled process and everything that is kept for it between ticks.
+struct ProfiledProcess {
+    PerfSymbolMap symbol_map;
+    SamplerContext context;
+    // Only with Engine::Perf.
+    std::unique_ptr<PerfEventSampler> perf_sampler;
+    // Interned "comm (pid)", see ProcessSample::process_tag_id.
+    uint64_t tag_id;
+
+    ProfiledProcess(SamplingSession& session, pid_t pid);
+    ProfiledProcess(const ProfiledProcess&) = delete;
+};
+
+// The processes of one session. All of them are sampled on the same tick,
+// one after another, with the session's worker pool.
+class ProcessSet {
+public:
+    ProcessSet(SamplingSession& session, Engine engine, uint64_t period_ns, bool tag_processes);
+    ProcessSet(const ProcessSet&) = delete;
+
+    // Starts sampling `pid`. Fails if it cannot be sampled, e.g. without
+    // perf_event_open permissions for it.
+    Result<bool, std::string> add(pid_t pid);
+    // --all_mono: adds every running process that has a /tmp/perf-<pid>.map.
+    // Returns the number of processes added. A process that cannot be added
+    // (e.g. one of another user) is reported once and skipped from then on.
+    Result<size_t, std::string> discover();
+    // Forgets processes that exited (or became zombies).
+    void remove_exited();
+
+    // Takes one sample of every process into `buffer` and calls fn after each
+    // of them; on success fn may move the sample out of `buffer`. Processes
+    // that exited are dropped instead of being reported as failures.
+    void sample(std::optional<uintptr_t> tid, ProcessSample& buffer, FunctionRef<void(pid_t, const Result<bool, std::string>&)> fn);
+
+    size_t size() const { return processes.size(); }
+    std::vector<pid_t> pids() const;
+
+    // Session totals of the perf engine, including processes that exited.
+    PerfEventSampler::Stats perf_stats() const;
+
+private:
+    SamplingSession& session;
+    Engine engine;
+    uint64_t period_ns;
+    bool tag_processes;
+    std::vector<std::unique_ptr<ProfiledProcess>> processes;
+    // Discovered processes that add() failed for.
+    std::vector<pid_t> skipped;
+    PerfEventSampler::Stats exited_perf_stats;
+};
+
+// True if the process is gone or only a zombie is left of it.
+bool process_exited(pid_t pid);
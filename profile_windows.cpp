@@ -0,0 +1,139 @@
+#include <iostream>
+#include <algorithm>
+#include <utility>
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "profile_windows.hpp"
+
+using std::string;
+using std::vector;
+
+ProfileWindows::ProfileWindows(StringPool& string_pool, string directory, uint32_t window_seconds, size_t keep_windows, size_t max_stacks, bool group_by_thread)
+    : directory_(std::move(directory)), window_seconds(window_seconds), keep_windows(keep_windows),
+      aggregator(string_pool, group_by_thread, max_stacks) {
+    window_start = window_start_for(time(nullptr));
+}
+
+uint64_t ProfileWindows::window_start_for(uint64_t unix_seconds) const {
+    // Aligned to the wall clock, so windows of different hosts line up.
+    return unix_seconds - unix_seconds % window_seconds;
+}
+
+void ProfileWindows::add(const ProcessSample& process_sample) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& thread_sample: process_sample.threads) {
+        aggregator.add(thread_sample, process_sample.process_tag_id);
+    }
+}
+
+void ProfileWindows::rotate(bool force) {
+    uint64_t now = time(nullptr);
+    if (!force && now < window_start + window_seconds) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (aggregator.total_samples() > 0) {
+        write_window();
+        remove_old_windows();
+    }
+    aggregator.clear();
+    window_start = window_start_for(now);
+}
+
+void ProfileWindows::write_window() {
+    time_t start = (time_t) window_start;
+    struct tm start_tm;
+    gmtime_r(&start, &start_tm);
+    char name[32];
+    strftime(name, sizeof(name), "%Y%m%dT%H%M%SZ", &start_tm);
+
+    string path = directory_ + "/" + name + WINDOW_SUFFIX;
+    // A new file, as in AsyncSampleWriter::dump_collapsed(), so that a
+    // symlink planted in a shared DIR is never written through. Its name is
+    // not listed by windows().
+    string tmp_path = directory_ + "/.mono_ssp-XXXXXX";
+    int fd = mkostemp(&tmp_path[0], O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Cannot write window to " << path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    fchmod(fd, 0644);
+
+    OutputBuffer out;
+    aggregator.write_folded(out);
+    bool written = out.flush_to(fd);
+    close(fd);
+    if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write window to " << path << "\n";
+        unlink(tmp_path.c_str());
+        return;
+    }
+
+    if (aggregator.truncated_samples() > 0) {
+        std::cerr << "Window " << name << ": " << aggregator.truncated_samples() << " samples of new stacks counted as [truncated]\n";
+    }
+}
+
+void ProfileWindows::remove_old_windows() {
+    vector<string> names = windows();
+    for (size_t i = 0; i + keep_windows < names.size(); ++i) {
+        unlink((directory_ + "/" + names[i]).c_str());
+    }
+}
+
+void ProfileWindows::current(OutputBuffer& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    aggregator.write_folded(out);
+}
+
+// Only names written by write_window() ("YYYYmmddTHHMMSSZ.folded"), so that
+// rotation never deletes other files in the directory.
+static bool is_window_name(const string& name) {
+    static const char PATTERN[] = "DDDDDDDDTDDDDDDZ";
+    size_t pattern_length = strlen(PATTERN);
+    if (name.size() != pattern_length + strlen(ProfileWindows::WINDOW_SUFFIX)
+        || name.compare(pattern_length, string::npos, ProfileWindows::WINDOW_SUFFIX) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < pattern_length; ++i) {
+        bool matches = PATTERN[i] == 'D' ? isdigit((unsigned char) name[i]) : name[i] == PATTERN[i];
+        if (!matches) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<string> ProfileWindows::windows() const {
+    vector<string> names;
+    DIR* dir = opendir(directory_.c_str());
+    if (dir == nullptr) {
+        return names;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        string name = entry->d_name;
+        if (!is_window_name(name)) {
+            continue;
+        }
+        names.push_back(std::move(name));
+    }
+    closedir(dir);
+
+    // The names start with the window time, so this is also the age order.
+    std::sort(names.begin(), names.end());
+    return names;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <stdint.h>
+
+#include "stringpool.hpp"
+#include "output_buffer.hpp"
+#include "stack_aggregator.hpp"
+#include "backtrace.hpp"
+
+// --daemon: stacks aggregated over fixed wall-clock windows. Every window
+// that has samples is written, in folded format, to
+// <directory>/<YYYYmmddTHHMMSSZ of its start>.folded (through a temporary
+// file and rename(), so readers never see a partial window). Only the newest
+// `keep_windows` files are kept.
+//
+// Memory stays flat: one StackAggregator, limited to `max_stacks` and
+// cleared (keeping its memory) after every window.
+//
+// add() and rotate() are called by the writer thread; current() and
+// windows() by WindowServer.
+class ProfileWindows {
+public:
+    static constexpr const char* WINDOW_SUFFIX = ".folded";
+
+    ProfileWindows(StringPool& string_pool, std::string directory, uint32_t window_seconds, size_t keep_windows, size_t max_stacks, bool group_by_thread);
+    ProfileWindows(const ProfileWindows&) = delete;
+
+    void add(const ProcessSample& process_sample);
+    // Writes out the current window if it is over, or unconditionally with
+    // `force` (at exit).
+    void rotate(bool force = false);
+
+    // Folded stacks of the window in progress.
+    void current(OutputBuffer& out);
+    // File names of the stored windows, oldest first.
+    std::vector<std::string> windows() const;
+    const std::string& directory() const { return directory_; }
+
+private:
+    std::string directory_;
+    uint32_t window_seconds;
+    size_t keep_windows;
+    std::mutex mutex;
+    StackAggregator aggregator;
+    // Unix time of the start of the window in progress.
+    uint64_t window_start;
+
+    uint64_t window_start_for(uint64_t unix_seconds) const;
+    void write_window();
+    void remove_old_windows();
+};
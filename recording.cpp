@@ -0,0 +1,340 @@
+#include <string>
+#include <utility>
+#include <cmath>
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "recording.hpp"
+
+using std::string;
+using std::to_string;
+using std::move;
+using std::vector;
+
+static const size_t FLUSH_THRESHOLD = 1 << 20;
+
+static int64_t to_microseconds(double seconds) {
+    return (int64_t) std::llround(seconds * 1e6);
+}
+
+Result<std::unique_ptr<RecordWriter>, string> RecordWriter::open(const string& path, StringPool& string_pool, double start_seconds) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return ResultInit::err(string("open(") + path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+    }
+
+    return ResultInit::ok(std::unique_ptr<RecordWriter>(new RecordWriter(fd, string_pool, start_seconds)));
+}
+
+RecordWriter::RecordWriter(int fd, StringPool& string_pool, double start_seconds)
+    : fd(fd), string_pool(string_pool), stacks(string_pool, false), last_timestamp_us(to_microseconds(start_seconds)) {
+    out.append(std::string_view(RECORD_MAGIC, sizeof(RECORD_MAGIC)));
+    out.append_varint(last_timestamp_us);
+}
+
+RecordWriter::~RecordWriter() {
+    finish();
+}
+
+void RecordWriter::write_string(uint64_t id) {
+    if (id < written_strings.size() && written_strings[id]) {
+        return;
+    }
+    if (id >= written_strings.size()) {
+        written_strings.resize(id + 1, false);
+    }
+    written_strings[id] = true;
+
+    auto value = string_pool.get_by_id(id);
+    out.append((char) RecordTag::String).append_varint(id).append_varint(value.size()).append(value);
+}
+
+void RecordWriter::write(const ProcessSample& process_sample) {
+    if (fd < 0) {
+        return;
+    }
+
+    out.append((char) RecordTag::Tick).append_varint(process_sample.pid);
+
+    for (const auto& t: process_sample.threads) {
+        frame_words.clear();
+        for (const auto& f: t.frames) {
+            frame_words.push_back(f.ip);
+            frame_words.push_back(f.name_id);
+            frame_words.push_back(f.name_offset);
+            frame_words.push_back(f.module_id);
+        }
+
+        size_t known_stacks = stacks.distinct_stacks();
+        uint32_t stack_id = stacks.intern(frame_words.data(), frame_words.size());
+        if (stack_id >= known_stacks) {
+            for (const auto& f: t.frames) {
+                if (f.name_id != StackFrame::NO_NAME) {
+                    write_string(f.name_id);
+                }
+                if (f.module_id != StackFrame::NO_NAME) {
+                    write_string(f.module_id);
+                }
+            }
+            out.append((char) RecordTag::Stack).append_varint(stack_id).append_varint(t.frames.size());
+            for (const auto& f: t.frames) {
+                out.append_varint(f.ip).append_varint(f.name_id + 1).append_varint(f.name_offset).append_varint(f.module_id + 1);
+            }
+        }
+
+        write_string(t.thread_name_id);
+        if (t.state.wchan_id != ThreadState::NO_WCHAN) {
+            write_string(t.state.wchan_id);
+        }
+
+        int64_t timestamp_us = to_microseconds(t.timestamp);
+        out.append((char) RecordTag::Sample)
+            .append_zigzag(timestamp_us - last_timestamp_us)
+            .append_varint(t.tid)
+            .append_varint(t.thread_name_id)
+            .append_varint(stack_id)
+            .append(t.state.run_state)
+            .append((char) (t.state.gc_suspended ? FLAG_GC_SUSPENDED : 0))
+            .append_zigzag(t.state.syscall)
+            .append_varint(t.state.wchan_id + 1);
+        last_timestamp_us = timestamp_us;
+    }
+
+    if (out.size() >= FLUSH_THRESHOLD) {
+        flush();
+    }
+}
+
+void RecordWriter::flush() {
+    bytes_written_ += out.size();
+    if (!out.flush_to(fd)) {
+        failed = true;
+    }
+}
+
+bool RecordWriter::finish() {
+    if (fd >= 0) {
+        flush();
+        if (close(fd) != 0) {
+            failed = true;
+        }
+        fd = -1;
+    }
+    return !failed;
+}
+
+Result<std::unique_ptr<RecordReader>, string> RecordReader::open(const string& path, StringPool& string_pool) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ResultInit::err(string("open(") + path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno));
+    }
+
+    std::unique_ptr<RecordReader> reader(new RecordReader(fd, string_pool));
+    auto header_result = reader->read_header();
+    if (!header_result.isOk()) {
+        return ResultInit::err(path + ": " + header_result.getErrRef());
+    }
+
+    return ResultInit::ok(move(reader));
+}
+
+RecordReader::RecordReader(int fd, StringPool& string_pool) : fd(fd), string_pool(string_pool), buffer(1 << 20) {}
+
+RecordReader::~RecordReader() {
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool RecordReader::fill() {
+    if (eof) {
+        return false;
+    }
+
+    ssize_t rc;
+    do {
+        rc = read(fd, buffer.data(), buffer.size());
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc <= 0) {
+        eof = true;
+        return false;
+    }
+
+    position = 0;
+    length = rc;
+    return true;
+}
+
+bool RecordReader::read_byte(uint8_t& value) {
+    if (position == length && !fill()) {
+        return false;
+    }
+    value = (uint8_t) buffer[position++];
+    return true;
+}
+
+bool RecordReader::read_varint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        if (!read_byte(byte)) {
+            return false;
+        }
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RecordReader::read_zigzag(int64_t& value) {
+    uint64_t encoded;
+    if (!read_varint(encoded)) {
+        return false;
+    }
+    value = (int64_t) (encoded >> 1) ^ -(int64_t) (encoded & 1);
+    return true;
+}
+
+bool RecordReader::read_bytes(string& value, size_t count) {
+    value.clear();
+    while (value.size() < count) {
+        if (position == length && !fill()) {
+            return false;
+        }
+        size_t chunk = std::min(count - value.size(), length - position);
+        value.append(buffer.data() + position, chunk);
+        position += chunk;
+    }
+    return true;
+}
+
+Result<bool, string> RecordReader::read_header() {
+    string magic;
+    uint64_t start;
+    if (!read_bytes(magic, sizeof(RECORD_MAGIC)) || memcmp(magic.data(), RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0) {
+        return ResultInit::err(string("not a mono_ssp recording"));
+    }
+    if (!read_varint(start)) {
+        return ResultInit::err(string("truncated header"));
+    }
+
+    start_timestamp_us = (int64_t) start;
+    last_timestamp_us = start_timestamp_us;
+    return ResultInit::ok(true);
+}
+
+uint64_t RecordReader::map_string(uint64_t recorded_id) const {
+    if (recorded_id >= strings.size()) {
+        return StackFrame::NO_NAME;
+    }
+    return strings[recorded_id];
+}
+
+Result<bool, string> RecordReader::next(ProcessSample& process_sample) {
+    process_sample.threads.clear();
+    process_sample.stats = SampleStats();
+    bool started = false;
+    if (has_pending_tick) {
+        process_sample.pid = pending_pid;
+        has_pending_tick = false;
+        started = true;
+    }
+
+    auto truncated = [](const char* what) {
+        return Result<bool, string>(ResultInit::err(string("truncated ") + what + " record"));
+    };
+
+    uint8_t tag;
+    while (read_byte(tag)) {
+        switch ((RecordTag) tag) {
+            case RecordTag::String: {
+                uint64_t id, size;
+                string value;
+                if (!read_varint(id) || !read_varint(size) || !read_bytes(value, size)) {
+                    return truncated("string");
+                }
+                if (id >= strings.size()) {
+                    uint64_t no_name = StackFrame::NO_NAME;
+                    strings.resize(id + 1, no_name);
+                }
+                strings[id] = string_pool.intern(value);
+                break;
+            }
+            case RecordTag::Stack: {
+                uint64_t id, count;
+                if (!read_varint(id) || !read_varint(count)) {
+                    return truncated("stack");
+                }
+                if (id >= stacks.size()) {
+                    stacks.resize(id + 1);
+                }
+                auto& frames = stacks[id];
+                frames.clear();
+                for (uint64_t i = 0; i < count; ++i) {
+                    uint64_t ip, name_id, name_offset, module_id;
+                    if (!read_varint(ip) || !read_varint(name_id) || !read_varint(name_offset) || !read_varint(module_id)) {
+                        return truncated("stack");
+                    }
+                    frames.push_back(StackFrame {
+                        ip,
+                        name_id == 0 ? StackFrame::NO_NAME : map_string(name_id - 1),
+                        name_offset,
+                        module_id == 0 ? StackFrame::NO_NAME : map_string(module_id - 1)
+                    });
+                }
+                break;
+            }
+            case RecordTag::Tick: {
+                uint64_t pid;
+                if (!read_varint(pid)) {
+                    return truncated("tick");
+                }
+                if (started) {
+                    has_pending_tick = true;
+                    pending_pid = pid;
+                    return ResultInit::ok(true);
+                }
+                process_sample.pid = pid;
+                started = true;
+                break;
+            }
+            case RecordTag::Sample: {
+                int64_t delta, syscall;
+                uint64_t tid, thread_name_id, stack_id, wchan_id;
+                uint8_t run_state, flags;
+                if (!read_zigzag(delta) || !read_varint(tid) || !read_varint(thread_name_id) || !read_varint(stack_id)
+                        || !read_byte(run_state) || !read_byte(flags) || !read_zigzag(syscall) || !read_varint(wchan_id)) {
+                    return truncated("sample");
+                }
+                if (stack_id >= stacks.size()) {
+                    return ResultInit::err("sample refers to unknown stack " + to_string(stack_id));
+                }
+
+                last_timestamp_us += delta;
+                ThreadSample thread_sample;
+                thread_sample.tid = tid;
+                thread_sample.timestamp = last_timestamp_us * 1e-6;
+                thread_sample.thread_name_id = map_string(thread_name_id);
+                thread_sample.state.run_state = (char) run_state;
+                thread_sample.state.gc_suspended = (flags & 1) != 0;
+                thread_sample.state.syscall = syscall;
+                thread_sample.state.wchan_id = wchan_id == 0 ? ThreadState::NO_WCHAN : map_string(wchan_id - 1);
+                thread_sample.frames = stacks[stack_id];
+                process_sample.threads.push_back(move(thread_sample));
+                break;
+            }
+            default:
+                return ResultInit::err("unknown record tag " + to_string(tag));
+        }
+    }
+
+    return ResultInit::ok(bool(started));
+}
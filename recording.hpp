@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdint.h>
+
+#include "result.hpp"
+#include "stringpool.hpp"
+#include "output_buffer.hpp"
+#include "stack_aggregator.hpp"
+#include "backtrace.hpp"
+
+// Binary recording of samples (--record FILE), replayed by `mono_ssp report`.
+//
+// The file starts with RECORD_MAGIC and the session start timestamp in
+// microseconds, followed by records that each start with a RecordTag byte:
+//   String: id, length, bytes (written before the first use of the id)
+//   Stack:  id, frame count, then (ip, name id + 1, name offset, module id + 1)
+//           per frame, leaf first
+//   Tick:   pid (starts a new ProcessSample)
+//   Sample: zigzag timestamp delta in microseconds, tid, thread name id,
+//           stack id, run state, flags, zigzag syscall, wchan id + 1
+// All integers are LEB128 varints; ids are StringPool ids of the recording
+// process, and stacks are deduplicated.
+static const char RECORD_MAGIC[8] = { 'M', 'S', 'S', 'P', 'R', 'E', 'C', '2' };
+
+enum class RecordTag : uint8_t {
+    String = 1,
+    Stack = 2,
+    Tick = 3,
+    Sample = 4,
+};
+
+class RecordWriter {
+public:
+    static Result<std::unique_ptr<RecordWriter>, std::string> open(const std::string& path, StringPool& string_pool, double start_seconds);
+
+    RecordWriter(const RecordWriter&) = delete;
+    ~RecordWriter();
+
+    void write(const ProcessSample& process_sample);
+    // Flushes and closes the file. Returns false if anything failed to write.
+    bool finish();
+
+    uint64_t bytes_written() const { return bytes_written_; }
+
+private:
+    static const uint8_t FLAG_GC_SUSPENDED = 1;
+
+    int fd;
+    StringPool& string_pool;
+    OutputBuffer out;
+    // Deduplicates stacks by their (ip, name id, offset, module id) tuples.
+    StackAggregator stacks;
+    std::vector<uint64_t> frame_words;
+    std::vector<bool> written_strings;
+    int64_t last_timestamp_us;
+    uint64_t bytes_written_ = 0;
+    bool failed = false;
+
+    RecordWriter(int fd, StringPool& string_pool, double start_seconds);
+    void write_string(uint64_t id);
+    void flush();
+};
+
+class RecordReader {
+public:
+    static Result<std::unique_ptr<RecordReader>, std::string> open(const std::string& path, StringPool& string_pool);
+
+    RecordReader(const RecordReader&) = delete;
+    ~RecordReader();
+
+    // Reads the next ProcessSample; returns false at the end of the file.
+    Result<bool, std::string> next(ProcessSample& process_sample);
+
+    double start_seconds() const { return start_timestamp_us * 1e-6; }
+
+private:
+    int fd;
+    StringPool& string_pool;
+    std::vector<char> buffer;
+    size_t position = 0;
+    size_t length = 0;
+    bool eof = false;
+    int64_t start_timestamp_us = 0;
+    int64_t last_timestamp_us = 0;
+    // Recorded string id -> id in our string pool.
+    std::vector<uint64_t> strings;
+    std::vector<std::vector<StackFrame>> stacks;
+    bool has_pending_tick = false;
+    uintptr_t pending_pid = 0;
+
+    RecordReader(int fd, StringPool& string_pool);
+    bool fill();
+    bool read_byte(uint8_t& value);
+    bool read_varint(uint64_t& value);
+    bool read_zigzag(int64_t& value);
+    bool read_bytes(std::string& value, size_t count);
+    Result<bool, std::string> read_header();
+    uint64_t map_string(uint64_t recorded_id) const;
+};
@@ -0,0 +1,164 @@
+#include <string.h>
+#include <errno.h>
+
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+
+#include "remote_memory.hpp"
+
+RemoteMemory::RemoteMemory(pid_t pid) : pid(pid) {}
+
+void RemoteMemory::reset(pid_t new_pid) {
+    pid = new_pid;
+    used_pages = 0;
+    last_page = nullptr;
+    snapshot_data = nullptr;
+    snapshot_size = 0;
+    snapshot_region_start = 0;
+    snapshot_region_end = 0;
+}
+
+void RemoteMemory::set_stack_snapshot(uintptr_t start, const uint8_t* data, size_t size, uintptr_t region_start, uintptr_t region_end) {
+    snapshot_start = start;
+    snapshot_data = data;
+    snapshot_size = size;
+    snapshot_region_start = region_start;
+    snapshot_region_end = region_end;
+}
+
+const RemoteMemory::Page* RemoteMemory::find_page(uintptr_t page_address) {
+    if (last_page != nullptr && last_page->address == page_address) {
+        return last_page;
+    }
+
+    for (size_t i = 0; i < used_pages; ++i) {
+        if (pages[i]->address == page_address) {
+            last_page = pages[i].get();
+            return last_page;
+        }
+    }
+
+    return nullptr;
+}
+
+const RemoteMemory::Page* RemoteMemory::fetch_page(uintptr_t page_address) {
+    ++stats_.page_misses;
+
+    if (used_pages + READ_AHEAD_PAGES > MAX_PAGES) {
+        // Cache is full (e.g. libunwind was bisecting a large .eh_frame_hdr
+        // table); start over instead of evicting individual pages.
+        used_pages = 0;
+        last_page = nullptr;
+    }
+
+    struct iovec local_iov[READ_AHEAD_PAGES];
+    struct iovec remote_iov[READ_AHEAD_PAGES];
+    size_t count = 0;
+    for (size_t i = 0; i < READ_AHEAD_PAGES; ++i) {
+        uintptr_t address = page_address + i * CACHE_PAGE_SIZE;
+        if (address < page_address) {
+            // wrapped around the address space
+            break;
+        }
+        if (i > 0 && find_page(address) != nullptr) {
+            break;
+        }
+
+        if (used_pages + count >= pages.size()) {
+            pages.push_back(std::make_unique<Page>());
+        }
+        Page* page = pages[used_pages + count].get();
+        page->address = address;
+
+        local_iov[count].iov_base = page->data;
+        local_iov[count].iov_len = CACHE_PAGE_SIZE;
+        remote_iov[count].iov_base = reinterpret_cast<void*>(address);
+        remote_iov[count].iov_len = CACHE_PAGE_SIZE;
+        ++count;
+    }
+
+    ++stats_.syscalls;
+    // Every remote iovec is a single page, so a partial read stops exactly at
+    // the first unreadable page.
+    ssize_t rc = process_vm_readv(pid, local_iov, count, remote_iov, count, 0);
+    if (rc <= 0) {
+        last_page = nullptr;
+        return nullptr;
+    }
+
+    size_t pages_read = (size_t) rc / CACHE_PAGE_SIZE;
+    if (pages_read == 0) {
+        last_page = nullptr;
+        return nullptr;
+    }
+
+    const Page* result = pages[used_pages].get();
+    used_pages += pages_read;
+    last_page = result;
+    return result;
+}
+
+size_t RemoteMemory::read(uintptr_t address, void* buffer, size_t length) {
+    ++stats_.reads;
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    size_t done = 0;
+
+    while (done < length) {
+        uintptr_t current = address + done;
+        if (current >= snapshot_region_start && current < snapshot_region_end) {
+            if (current < snapshot_start || current - snapshot_start >= snapshot_size) {
+                break;
+            }
+            size_t snapshot_offset = current - snapshot_start;
+            size_t chunk = snapshot_size - snapshot_offset;
+            if (chunk > length - done) {
+                chunk = length - done;
+            }
+            memcpy(out + done, snapshot_data + snapshot_offset, chunk);
+            done += chunk;
+            continue;
+        }
+
+        uintptr_t page_address = current & ~(CACHE_PAGE_SIZE - 1);
+        const Page* page = find_page(page_address);
+        if (page == nullptr) {
+            page = fetch_page(page_address);
+            if (page == nullptr) {
+                break;
+            }
+        }
+
+        size_t page_offset = current - page_address;
+        size_t chunk = CACHE_PAGE_SIZE - page_offset;
+        if (chunk > length - done) {
+            chunk = length - done;
+        }
+        memcpy(out + done, page->data + page_offset, chunk);
+        done += chunk;
+    }
+
+    return done;
+}
+
+bool RemoteMemory::read_word(uintptr_t address, uint64_t& value) {
+    if (read(address, &value, sizeof(value)) == sizeof(value)) {
+        return true;
+    }
+
+    // process_vm_readv() may be unavailable (old kernels, some seccomp
+    // profiles) while the thread is still ptrace-stopped; fall back to
+    // reading a single word.
+    if (snapshot_data != nullptr) {
+        // Not stopped: the thread keeps running while its captured stack is unwound.
+        return false;
+    }
+    ++stats_.peek_fallbacks;
+    errno = 0;
+    long word = ptrace(PTRACE_PEEKDATA, pid, address, 0);
+    if (word == -1 && errno != 0) {
+        return false;
+    }
+
+    value = (uint64_t) word;
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+// Cache of target memory pages, filled in bulk via process_vm_readv().
+// The target memory changes as soon as the thread is resumed, so the cache
+// must be reset() before every sample.
+class RemoteMemory {
+public:
+    static const uintptr_t CACHE_PAGE_SIZE = 4096;
+    // Stacks grow down and unwinding walks up, so on a miss we also read a few
+    // pages above the requested one.
+    static const size_t READ_AHEAD_PAGES = 4;
+    static const size_t MAX_PAGES = 256;
+
+    struct Stats {
+        uint64_t reads = 0;
+        uint64_t page_misses = 0;
+        uint64_t syscalls = 0;
+        uint64_t peek_fallbacks = 0;
+    };
+
+    explicit RemoteMemory(pid_t pid = 0);
+    RemoteMemory(const RemoteMemory&) = delete;
+
+    void reset(pid_t pid);
+    void reset() { reset(pid); }
+
+    // Serves [start, start + size) from a stack copy captured by the kernel
+    // (see PerfEventSampler) instead of the live, still running, thread.
+    // The rest of the stack mapping [region_start, region_end) is treated as
+    // unreadable: it has moved on since the capture. Cleared by reset().
+    void set_stack_snapshot(uintptr_t start, const uint8_t* data, size_t size, uintptr_t region_start, uintptr_t region_end);
+
+    bool read_word(uintptr_t address, uint64_t& value);
+    // Returns the number of bytes actually read (from the start of the range).
+    size_t read(uintptr_t address, void* buffer, size_t length);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Page {
+        uintptr_t address;
+        uint8_t data[CACHE_PAGE_SIZE];
+    };
+
+    pid_t pid;
+    std::vector<std::unique_ptr<Page>> pages;
+    size_t used_pages = 0;
+    const Page* last_page = nullptr;
+    Stats stats_;
+
+    uintptr_t snapshot_start = 0;
+    const uint8_t* snapshot_data = nullptr;
+    size_t snapshot_size = 0;
+    uintptr_t snapshot_region_start = 0;
+    uintptr_t snapshot_region_end = 0;
+
+    const Page* find_page(uintptr_t page_address);
+    const Page* fetch_page(uintptr_t page_address);
+};
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "report.hpp"
+#include "recording.hpp"
+#include "sample_writer.hpp"
+#include "stack_aggregator.hpp"
+
+using std::cerr;
+using std::string;
+using std::vector;
+
+enum class ReportFormat {
+    PerfScript,
+    Collapsed,
+    Debug,
+};
+
+int report_main(int argc, char** argv) {
+    vector<string> args { &argv[1], &argv[argc] };
+    string path;
+    ReportFormat format = ReportFormat::PerfScript;
+    bool collapsed_by_thread = false;
+    bool parsed = true;
+
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        if (*it == "--format" && it + 1 != args.end()) {
+            ++it;
+            if (*it == "perf_script") {
+                format = ReportFormat::PerfScript;
+            } else if (*it == "collapsed") {
+                format = ReportFormat::Collapsed;
+            } else if (*it == "debug") {
+                format = ReportFormat::Debug;
+            } else {
+                cerr << "Unknown format: " << *it << "\n";
+                parsed = false;
+            }
+        } else if (*it == "--collapsed_by_thread") {
+            format = ReportFormat::Collapsed;
+            collapsed_by_thread = true;
+        } else if (path.empty() && it->rfind("--", 0) != 0) {
+            path = *it;
+        } else {
+            cerr << "Unknown arguments: " << *it << "\n";
+            parsed = false;
+        }
+    }
+
+    if (!parsed || path.empty()) {
+        cerr << "Usage: mono-ssp report FILE [--format perf_script|collapsed|debug] [--collapsed_by_thread]\n";
+        return 1;
+    }
+
+    StringPool string_pool;
+    auto reader_result = RecordReader::open(path, string_pool);
+    if (!reader_result.isOk()) {
+        cerr << reader_result.getErrRef() << "\n";
+        return 1;
+    }
+    auto reader = std::move(reader_result).getOkRef();
+
+    StackAggregator aggregator(string_pool, collapsed_by_thread);
+    OutputBuffer out;
+    ProcessSample process_sample;
+    uint64_t process_samples = 0;
+
+    while (true) {
+        auto next_result = reader->next(process_sample);
+        if (!next_result.isOk()) {
+            out.flush_to(STDOUT_FILENO);
+            cerr << path << ": " << next_result.getErrRef() << "\n";
+            return 1;
+        }
+        if (!next_result.getOkRef()) {
+            break;
+        }
+        ++process_samples;
+
+        switch (format) {
+            case ReportFormat::PerfScript:
+                format_perf_script(process_sample, string_pool, reader->start_seconds(), out);
+                break;
+            case ReportFormat::Debug:
+                format_debug(process_sample, string_pool, reader->start_seconds(), out);
+                break;
+            case ReportFormat::Collapsed:
+                for (const auto& thread_sample: process_sample.threads) {
+                    aggregator.add(thread_sample);
+                }
+                break;
+        }
+
+        if (out.size() >= AsyncSampleWriter::FLUSH_THRESHOLD) {
+            out.flush_to(STDOUT_FILENO);
+        }
+    }
+
+    if (format == ReportFormat::Collapsed) {
+        aggregator.write_folded(out);
+    }
+    out.flush_to(STDOUT_FILENO);
+
+    cerr << "Replayed " << process_samples << " process samples\n";
+    return 0;
+}
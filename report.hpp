@@ -0,0 +1,4 @@
+#pragma once
+
+// `mono_ssp report FILE ...`: replays a --record file. argv[0] is "report".
+int report_main(int argc, char** argv);
@@ -2,6 +2,8 @@
 #include <utility>
 #include <iostream>
 #include <optional>
+#include <chrono>
+#include <algorithm>
 
 #include <stdlib.h>
 #include <errno.h>
@@ -12,6 +14,7 @@
 #include <sys/types.h>
 
 #include "backtrace.hpp"
+#include "scheduler.hpp"
 
 using std::optional;
 using std::string;
@@ -19,71 +22,320 @@ using std::to_string;
 using std::move;
 using std::vector;
 
-static Result<ProcessSample, string> fail(std::string&& message) {
-    return Result<ProcessSample, string>::fail(move(message));
+// Picks up new perf map entries and mapping changes before a sample.
+static Result<bool, string> refresh_maps(SamplerContext& context) {
+    PhaseTimer timer(context.phase_stats, Phase::RefreshMaps);
+    context.symbol_map.maybeAppend();
+    // New lines may name addresses that were cached as unknown, or replace
+    // the symbols of code that was JIT-compiled again.
+    vector<SymbolCache::Range>& jit_ranges = context.buffers.jit_ranges;
+    jit_ranges.clear();
+    for (const auto& symbol: context.symbol_map.appended()) {
+        jit_ranges.push_back(SymbolCache::Range { symbol.offset, symbol.offset + symbol.length });
+    }
+    context.symbol_cache.invalidate(jit_ranges);
+
+    vector<MemoryMapping>& removed_mappings = context.buffers.removed_mappings;
+    auto refresh_result = context.unwind_registry.refresh(removed_mappings);
+    if (!refresh_result.isOk()) {
+        return ResultInit::err(string(refresh_result.getErrRef()));
+    }
+    if (refresh_result.getOkRef()) {
+        context.elf_symbolizer.update(context.unwind_registry.maps().mappings());
+    }
+    for (const auto& mapping: removed_mappings) {
+        context.symbol_cache.invalidate(mapping.start, mapping.end);
+    }
+
+    return ResultInit::ok(true);
 }
 
-Result<vector<uintptr_t>, string> get_threads(uintptr_t pid) {
-    vector<uintptr_t> result;
+// Fills context.buffers.thread_ids; per-thread state of exited threads is dropped.
+static Result<bool, string> list_threads(SamplerContext& context, optional<uintptr_t> tid) {
+    PhaseTimer timer(context.phase_stats, Phase::ListThreads);
+
+    TickBuffers& buffers = context.buffers;
+    if (tid.has_value()) {
+        buffers.thread_ids.clear();
+        buffers.thread_ids.push_back(*tid);
+        return ResultInit::ok(true);
+    }
+
+    auto refresh_result = context.thread_lister.refresh();
+    if (!refresh_result.isOk()) {
+        return ResultInit::err(string(refresh_result.getErrRef()));
+    }
+    buffers.thread_ids = context.thread_lister.tids();
 
-    string proc_path = string("/proc/") + to_string(pid) + "/task";
-    DIR* proc_dir = opendir(proc_path.c_str());
+    // Retaining builds a set of the live threads; only do it when they changed.
+    if (refresh_result.getOkRef()) {
+        context.unwind_registry.retain_threads(buffers.thread_ids);
+        context.thread_files.retain_threads(buffers.thread_ids);
+        context.idle_threads.retain_threads(buffers.thread_ids);
+    }
 
-    if (proc_dir) {
-        struct dirent* entry;
-        while ((entry = readdir(proc_dir)) != nullptr) {
-            if (entry->d_name[0] == '.') {
-                continue;
-            }
+    return ResultInit::ok(true);
+}
 
-            int tid = atoi(entry->d_name);
-            if (tid != 0) {
-                result.push_back(tid);
+// Moves the samples that were taken (sampled[i] != 0) to the front, keeping
+// the frame buffers of all elements for the next tick.
+static void compact_samples(vector<ThreadSample>& threads, const vector<uint8_t>& sampled) {
+    size_t count = 0;
+    for (size_t i = 0; i < threads.size(); ++i) {
+        if (sampled[i]) {
+            if (i != count) {
+                std::swap(threads[count], threads[i]);
             }
+            ++count;
         }
-
-        closedir(proc_dir);
-    } else if (errno == ENOENT) {
-        // do nothing
-    } else {
-        int errno_copy = errno;
-        return Result<vector<uintptr_t>, string>::fail(string("opendir(") + proc_path + ") failed: errno = " + to_string(errno) + " message = " + strerror(errno_copy));
     }
+    threads.resize(count);
+}
 
-    return Result<vector<uintptr_t>, string>::success(move(result));
+static void fill_session_stats(SamplerContext& context, SampleStats& stats) {
+    stats.proc_info_lookups = context.unwind_registry.proc_info_lookups();
+    stats.cache_flushes = context.unwind_registry.cache_flushes();
+    stats.spliced_frames = context.unwind_registry.spliced_frames();
+    stats.idle_threads_reused = context.idle_threads.reused();
+    stats.thread_list_rescans = context.thread_lister.rescans();
+    auto symbol_stats = context.symbol_cache.stats();
+    stats.symbol_cache_hits = symbol_stats.hits;
+    stats.symbol_cache_misses = symbol_stats.misses;
+    stats.symbol_resolve_nanoseconds = symbol_stats.resolve_nanoseconds;
 }
 
-Result<ProcessSample, std::string> sample_process(StringPool& string_pool, PerfSymbolMap& symbol_map, uintptr_t pid, std::optional<uintptr_t> tid) {
-    symbol_map.maybeAppend();
-    vector<uintptr_t> thread_ids;
-    if (tid.has_value()) {
-        thread_ids.push_back(*tid);
-    } else {
-        auto threads_result = get_threads(pid);
-        if (!threads_result.isOk()) {
-            return fail(string(threads_result.getErrRef()));
-        }
+Result<bool, std::string> sample_process(SamplerContext& context, std::optional<uintptr_t> tid, ProcessSample& result) {
+    auto sample_start = std::chrono::steady_clock::now();
+    uint64_t tick_start_ns = monotonic_now_ns();
+    PhaseTimer tick_timer(context.phase_stats, Phase::Tick);
 
-        thread_ids = move(threads_result.getOkRef());
+    auto refresh_result = refresh_maps(context);
+    if (!refresh_result.isOk()) {
+        return refresh_result;
     }
 
-    vector<ThreadSample> thread_samples;
+    auto threads_result = list_threads(context, tid);
+    if (!threads_result.isOk()) {
+        return threads_result;
+    }
 
+    TickBuffers& buffers = context.buffers;
+    const vector<uintptr_t>& thread_ids = buffers.thread_ids;
+    size_t jobs = context.workers.size();
+    vector<ThreadStop>& stops = buffers.stops;
+    stops.clear();
     for (uintptr_t tid: thread_ids) {
-        auto thread_sample_result = sample_thread(string_pool, symbol_map, tid);
-        if (thread_sample_result.isOk()) {
-            if (thread_sample_result.getOkRef().has_value()) {
-                ThreadSample thread_sample = move(thread_sample_result).getOkRef().value();
-                thread_samples.push_back(move(thread_sample));
+        stops.emplace_back(tid);
+    }
+    vector<ThreadState>& states = buffers.states;
+    states.assign(thread_ids.size(), ThreadState());
+    vector<uint8_t>& sampled = buffers.sampled;
+    sampled.assign(thread_ids.size(), 0);
+    vector<optional<string>>& errors = buffers.errors;
+    errors.resize(jobs);
+    for (auto& error: errors) {
+        error.reset();
+    }
+    // Samples are written in place, reusing the frame buffers of `result`.
+    vector<ThreadSample>& threads = result.threads;
+    threads.resize(thread_ids.size());
+
+    // Threads are assigned to workers by tid, so a given thread is always
+    // stopped, waited for and released by the same tracer.
+    auto is_owned_by = [&](size_t i, size_t worker) {
+        return thread_ids[i] % jobs == worker;
+    };
+
+    if (context.snapshot) {
+        context.workers.run([&](size_t worker) {
+            for (size_t i = 0; i < stops.size(); ++i) {
+                if (!is_owned_by(i, worker)) {
+                    continue;
+                }
+                PhaseTimer timer(context.phase_stats, Phase::ReadState);
+                context.thread_files.read_state(thread_ids[i], context.string_pool, states[i]);
+                sampled[i] = reuse_idle_sample(context, thread_ids[i], states[i], threads[i]);
+            }
+
+            for (size_t i = 0; i < stops.size(); ++i) {
+                if (!is_owned_by(i, worker) || sampled[i]) {
+                    continue;
+                }
+                PhaseTimer interrupt_timer(context.phase_stats, Phase::Interrupt);
+                auto interrupt_result = stops[i].interrupt();
+                interrupt_timer.stop();
+                if (!interrupt_result.isOk() && !errors[worker].has_value()) {
+                    errors[worker] = string("Interrupting thread ") + to_string(thread_ids[i]) + " failed: " + move(interrupt_result).getErrRef();
+                }
+            }
+
+            for (size_t i = 0; i < stops.size(); ++i) {
+                if (!is_owned_by(i, worker) || !stops[i].seized()) {
+                    continue;
+                }
+                PhaseTimer wait_timer(context.phase_stats, Phase::Wait);
+                auto wait_result = stops[i].wait();
+                wait_timer.stop();
+                if (!wait_result.isOk()) {
+                    if (!errors[worker].has_value()) {
+                        errors[worker] = string("Waiting for thread ") + to_string(thread_ids[i]) + " failed: " + move(wait_result).getErrRef();
+                    }
+                    continue;
+                }
+                auto sample_result = sample_stopped_thread(context, stops[i], states[i], threads[i]);
+                if (!sample_result.isOk()) {
+                    if (!errors[worker].has_value()) {
+                        errors[worker] = string("Tracing thread ") + to_string(thread_ids[i]) + " failed: " + move(sample_result).getErrRef();
+                    }
+                    continue;
+                }
+                sampled[i] = 1;
+            }
+        });
+
+        // Every thread stays frozen until all of them have been sampled.
+        context.workers.run([&](size_t worker) {
+            for (size_t i = 0; i < stops.size(); ++i) {
+                if (is_owned_by(i, worker) && stops[i].seized()) {
+                    PhaseTimer timer(context.phase_stats, Phase::Release);
+                    stops[i].release();
+                }
+            }
+        });
+    } else {
+        context.workers.run([&](size_t worker) {
+            for (size_t i = 0; i < stops.size(); ++i) {
+                if (!is_owned_by(i, worker)) {
+                    continue;
+                }
+                if (context.spread_ns != 0) {
+                    uint64_t spread_start_ns = context.spread_start_ns != 0 ? context.spread_start_ns : tick_start_ns;
+                    sleep_until_ns(spread_start_ns + context.spread_ns * i / stops.size());
+                }
+
+                auto thread_sample_result = sample_thread(context, stops[i], threads[i]);
+                // release here even on error: the destructor would run on the wrong thread
+                stops[i].release();
+                if (thread_sample_result.isOk()) {
+                    sampled[i] = thread_sample_result.getOkRef();
+                } else {
+                    errors[worker] = string("Tracing thread ") + to_string(thread_ids[i]) + " failed: " + move(thread_sample_result).getErrRef();
+                    return;
+                }
             }
-        } else {
-            return fail(string("Tracing thread ") + to_string(tid) + "failed: " + move(thread_sample_result).getErrRef());
+        });
+    }
+
+    // In snapshot mode the errors are those of single threads, which are
+    // left out of the sample: the tick only fails if no thread was sampled.
+    bool any_sampled = std::find(sampled.begin(), sampled.end(), 1) != sampled.end();
+    for (auto& error: errors) {
+        if (error.has_value() && (!context.snapshot || !any_sampled)) {
+            return ResultInit::err(move(*error));
+        }
+    }
+
+    double total_stop_seconds = 0;
+    optional<std::chrono::steady_clock::time_point> first_interrupt, last_release;
+    for (const auto& stop: stops) {
+        if (!stop.was_stopped()) {
+            continue;
+        }
+        auto stopped_for = stop.released_at - stop.interrupted_at;
+        total_stop_seconds += std::chrono::duration<double>(stopped_for).count();
+        context.phase_stats.record(Phase::ThreadStopped, std::chrono::duration_cast<std::chrono::nanoseconds>(stopped_for).count());
+        if (!first_interrupt.has_value() || stop.interrupted_at < *first_interrupt) {
+            first_interrupt = stop.interrupted_at;
+        }
+        if (!last_release.has_value() || stop.released_at > *last_release) {
+            last_release = stop.released_at;
+        }
+    }
+
+    // Stopped threads have been released and mostly went back to sleep by now.
+    context.idle_threads.settle(context.thread_files);
+
+    // Threads that could not be sampled are gone: list them again next time.
+    if (!tid.has_value() && std::find(sampled.begin(), sampled.end(), 0) != sampled.end()) {
+        context.thread_lister.invalidate();
+    }
+    compact_samples(threads, sampled);
+
+    if (context.defer_symbols) {
+        // All threads are running again; the symbol tables are only updated
+        // at the start of the next sample_process().
+        symbolize_samples(context, threads);
+    }
+
+    result.pid = context.pid;
+    result.process_tag_id = StackFrame::NO_NAME;
+    result.stats = SampleStats();
+    result.stats.total_stop_seconds = total_stop_seconds;
+    if (first_interrupt.has_value()) {
+        result.stats.stop_window_seconds = std::chrono::duration<double>(*last_release - *first_interrupt).count();
+    }
+    fill_session_stats(context, result.stats);
+    result.stats.duration_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sample_start).count();
+
+    return ResultInit::ok(true);
+}
+
+Result<bool, std::string> sample_perf_events(SamplerContext& context, PerfEventSampler& sampler, std::optional<uintptr_t> tid, ProcessSample& result) {
+    auto sample_start = std::chrono::steady_clock::now();
+    PhaseTimer tick_timer(context.phase_stats, Phase::Tick);
+
+    // Samples in the rings were taken with the maps as of now or earlier;
+    // mappings that went away since then can not be unwound through anymore.
+    auto refresh_result = refresh_maps(context);
+    if (!refresh_result.isOk()) {
+        return refresh_result;
+    }
+
+    // Drain before syncing, so the last samples of exited threads are kept.
+    // The number of samples is not known up front; elements past `count`
+    // are kept (with their frame buffers) until the end.
+    vector<ThreadSample>& threads = result.threads;
+    size_t count = 0;
+    optional<string> error;
+    sampler.drain([&](const CapturedStack& captured) {
+        if (error.has_value()) {
+            return;
         }
+        if (count == threads.size()) {
+            threads.emplace_back();
+        }
+        auto sample_result = sample_captured_stack(context, captured, threads[count]);
+        if (!sample_result.isOk()) {
+            error = string("Unwinding sample of thread ") + to_string(captured.tid) + " failed: " + move(sample_result).getErrRef();
+            return;
+        }
+        ++count;
+    });
+    threads.resize(count);
+    if (error.has_value()) {
+        return ResultInit::err(move(*error));
+    }
+
+    auto threads_result = list_threads(context, tid);
+    if (!threads_result.isOk()) {
+        return threads_result;
     }
-    
-    ProcessSample result;
-    result.pid = pid;
-    result.threads = move(thread_samples);
+    auto sync_result = sampler.sync_threads(context.buffers.thread_ids);
+    if (!sync_result.isOk()) {
+        return sync_result;
+    }
+
+    if (context.defer_symbols) {
+        symbolize_samples(context, threads);
+    }
+
+    result.pid = context.pid;
+    result.process_tag_id = StackFrame::NO_NAME;
+    result.stats = SampleStats();
+    fill_session_stats(context, result.stats);
+    result.stats.perf_samples = sampler.stats().samples;
+    result.stats.perf_lost_samples = sampler.stats().lost;
+    result.stats.duration_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sample_start).count();
 
-    return Result<ProcessSample, string>::success(move(result));
+    return ResultInit::ok(true);
 }
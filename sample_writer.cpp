@@ -0,0 +1,237 @@
+#include <chrono>
+#include <utility>
+
+#include <iostream>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "sample_writer.hpp"
+
+using std::move;
+using std::string;
+
+static std::atomic<bool> collapsed_dump_requested { false };
+
+void request_collapsed_dump() {
+    collapsed_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+void format_perf_script(const ProcessSample& process_sample, StringPool& string_pool, double start_seconds, OutputBuffer& out, bool with_pid) {
+    for (const auto& t: process_sample.threads) {
+        out.append(string_pool.get_by_id(t.thread_name_id)).append(' ');
+        if (with_pid) {
+            // "comm pid/tid", as `perf script` prints it for system-wide profiles
+            out.append_dec(process_sample.pid).append('/');
+        }
+        out.append_dec(t.tid).append(" [000] ")
+            .append_fixed(t.timestamp - start_seconds, 6).append(": wall-clock:").append(t.state.category()).append('\n');
+
+        for (const auto& f: t.frames) {
+            out.append("\t    ").append_hex(f.ip).append(' ');
+            if (f.name_id == StackFrame::NO_NAME) {
+                out.append("unknown");
+            } else {
+                out.append(string_pool.get_by_id(f.name_id)).append("+0x").append_hex(f.name_offset);
+            }
+            out.append(" (").append(f.module_id == StackFrame::NO_NAME ? "[unknown]" : string_pool.get_by_id(f.module_id)).append(")\n");
+        }
+        out.append('\n');
+    }
+}
+
+void format_debug(const ProcessSample& process_sample, StringPool& string_pool, double start_seconds, OutputBuffer& out) {
+    const auto& stats = process_sample.stats;
+    out.append("sample_process() took ").append_fixed(stats.duration_seconds, 6).append(" seconds")
+        .append(" (unwind info lookups: ").append_dec(stats.proc_info_lookups)
+        .append(", cache flushes: ").append_dec(stats.cache_flushes)
+        .append(", reused frames: ").append_dec(stats.spliced_frames)
+        .append(", reused idle threads: ").append_dec(stats.idle_threads_reused)
+        .append(", thread list rescans: ").append_dec(stats.thread_list_rescans).append(")\n");
+    uint64_t symbol_lookups = stats.symbol_cache_hits + stats.symbol_cache_misses;
+    if (symbol_lookups != 0) {
+        out.append("symbol cache: hit rate ").append_fixed(100.0 * stats.symbol_cache_hits / symbol_lookups, 2)
+            .append("% (").append_dec(stats.symbol_cache_hits).append(" of ").append_dec(symbol_lookups).append(" frames)")
+            .append(", resolve time ").append_fixed(double(stats.symbol_resolve_nanoseconds) / symbol_lookups, 1).append(" ns/frame\n");
+    }
+    if (stats.perf_samples != 0) {
+        out.append("perf samples: ").append_dec(stats.perf_samples).append(", lost: ").append_dec(stats.perf_lost_samples).append("\n");
+    }
+    out.append("Trace successful\n");
+    out.append(" PID = ").append_dec(process_sample.pid)
+        .append(" stop time = ").append_fixed(stats.total_stop_seconds, 6).append(" thread-seconds")
+        .append(" stop window = ").append_fixed(stats.stop_window_seconds, 6).append(" seconds\n");
+
+    for (const auto& t: process_sample.threads) {
+        out.append("  Time = ").append_fixed(t.timestamp - start_seconds, 6)
+            .append(" TID = ").append_dec(t.tid)
+            .append(" Name = ").append(string_pool.get_by_id(t.thread_name_id))
+            .append(" State = ").append(t.state.run_state)
+            .append(" Syscall = ").append_dec(t.state.syscall)
+            .append(" Wchan = ").append(t.state.wchan_id == ThreadState::NO_WCHAN ? "-" : string_pool.get_by_id(t.state.wchan_id))
+            .append(" Category = ").append(t.state.category()).append('\n');
+
+        for (const auto& f: t.frames) {
+            out.append("   IP = ").append_hex(f.ip);
+            if (f.name_id != StackFrame::NO_NAME) {
+                out.append(" name = ").append(string_pool.get_by_id(f.name_id)).append("+0x").append_hex(f.name_offset);
+            }
+            if (f.module_id != StackFrame::NO_NAME) {
+                out.append(" module = ").append(string_pool.get_by_id(f.module_id));
+            }
+            out.append('\n');
+        }
+    }
+}
+
+AsyncSampleWriter::AsyncSampleWriter(StringPool& string_pool, OutputOptions options, size_t queue_capacity)
+    : string_pool(string_pool), options(options), queue(queue_capacity), recycled(queue_capacity) {
+    thread = std::thread(&AsyncSampleWriter::run, this);
+}
+
+AsyncSampleWriter::~AsyncSampleWriter() {
+    finish();
+}
+
+bool AsyncSampleWriter::submit(ProcessSample&& process_sample) {
+    if (!queue.try_push(move(process_sample))) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    wakeup.notify_one();
+    return true;
+}
+
+void AsyncSampleWriter::finish() {
+    if (!thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping.store(true);
+    }
+    wakeup.notify_one();
+    thread.join();
+}
+
+void AsyncSampleWriter::run() {
+    OutputBuffer perf_script_out;
+    OutputBuffer debug_out(options.debug ? 1 << 20 : 0);
+    StackAggregator aggregator(string_pool, options.collapsed_by_thread);
+    ProcessSample process_sample;
+
+    while (true) {
+        while (queue.try_pop(process_sample)) {
+            auto output_started_at = std::chrono::steady_clock::now();
+            if (options.debug) {
+                format_debug(process_sample, string_pool, options.start_seconds, debug_out);
+            }
+            if (options.perf_script) {
+                format_perf_script(process_sample, string_pool, options.start_seconds, perf_script_out, options.tag_processes);
+            }
+            if (options.record != nullptr) {
+                options.record->write(process_sample);
+            }
+            if (options.windows != nullptr) {
+                options.windows->add(process_sample);
+            }
+            if (options.collapsed) {
+                for (const auto& thread_sample: process_sample.threads) {
+                    aggregator.add(thread_sample, process_sample.process_tag_id);
+                }
+            }
+
+            if (debug_out.size() >= FLUSH_THRESHOLD) {
+                debug_out.flush_to(STDERR_FILENO);
+            }
+            if (perf_script_out.size() >= FLUSH_THRESHOLD) {
+                perf_script_out.flush_to(STDOUT_FILENO);
+            }
+
+            if (options.phase_stats != nullptr) {
+                options.phase_stats->record(Phase::Output,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - output_started_at).count());
+            }
+            // If the sampling thread has not taken the previous ones back yet,
+            // this one is simply overwritten by the next try_pop().
+            recycled.try_push(move(process_sample));
+        }
+
+        // Idle: write out what we have, so that output is not held back for long.
+        if (!debug_out.empty()) {
+            debug_out.flush_to(STDERR_FILENO);
+        }
+        if (!perf_script_out.empty()) {
+            perf_script_out.flush_to(STDOUT_FILENO);
+        }
+
+        if (options.collapsed && collapsed_dump_requested.exchange(false)) {
+            dump_collapsed(aggregator);
+        }
+        if (options.windows != nullptr) {
+            options.windows->rotate();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping.load() && queue.empty()) {
+            break;
+        }
+        // submit() notifies without taking the lock, so a wakeup may be
+        // missed; the timeout bounds the resulting delay.
+        wakeup.wait_for(lock, std::chrono::milliseconds(10));
+    }
+
+    if (options.record != nullptr && !options.record->finish()) {
+        std::cerr << "Failed to write the recording\n";
+    }
+
+    if (options.windows != nullptr) {
+        options.windows->rotate(true);
+    }
+
+    if (options.collapsed) {
+        OutputBuffer out;
+        aggregator.write_folded(out);
+        out.flush_to(STDOUT_FILENO);
+        if (options.debug) {
+            std::cerr << "Collapsed " << aggregator.total_samples() << " thread samples into " << aggregator.distinct_stacks()
+                << " distinct stacks (" << aggregator.memory_bytes() << " bytes)\n";
+        }
+    }
+}
+
+void AsyncSampleWriter::dump_collapsed(const StackAggregator& aggregator) {
+    // Written to a new file next to the destination and renamed, so readers
+    // never see a partial dump. mkostemp() never reuses an existing name, and
+    // rename() replaces a symlink at the destination instead of following it.
+    const string& path = options.collapsed_dump_path;
+    size_t slash = path.rfind('/');
+    string tmp_path = (slash == string::npos ? string() : path.substr(0, slash + 1)) + ".mono_ssp-XXXXXX";
+    int fd = mkostemp(&tmp_path[0], O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Cannot write collapsed stacks to " << path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    fchmod(fd, 0644);
+
+    OutputBuffer out;
+    aggregator.write_folded(out);
+    bool written = out.flush_to(fd);
+    close(fd);
+    if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write collapsed stacks to " << path << "\n";
+        unlink(tmp_path.c_str());
+        return;
+    }
+
+    std::cerr << "Collapsed stacks (" << aggregator.total_samples() << " thread samples) written to " << path << "\n";
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <string>
+#include <stdint.h>
+
+#include "backtrace.hpp"
+#include "spsc_queue.hpp"
+#include "output_buffer.hpp"
+#include "stack_aggregator.hpp"
+#include "recording.hpp"
+#include "profile_windows.hpp"
+
+struct OutputOptions {
+    bool perf_script = false;
+    bool debug = false;
+    // Timestamps are printed relative to this moment.
+    double start_seconds = 0;
+    // Aggregate stacks and print them in folded format at the end.
+    bool collapsed = false;
+    bool collapsed_by_thread = false;
+    // Several processes are profiled: print "pid/tid" in perf script output
+    // and make the process the root frame of collapsed stacks.
+    bool tag_processes = false;
+    // Where request_collapsed_dump() writes the stacks aggregated so far.
+    std::string collapsed_dump_path;
+    // --record: binary recording, owned by the caller; finished by the writer.
+    RecordWriter* record = nullptr;
+    // --daemon: aggregated windows, owned by the caller; rotated by the writer.
+    ProfileWindows* windows = nullptr;
+    // Receives Phase::Output timings if set.
+    PhaseStats* phase_stats = nullptr;
+};
+
+// Asks the writer to dump the collapsed stacks aggregated so far. Async-signal-safe.
+void request_collapsed_dump();
+
+void format_perf_script(const ProcessSample& process_sample, StringPool& string_pool, double start_seconds, OutputBuffer& out, bool with_pid = false);
+void format_debug(const ProcessSample& process_sample, StringPool& string_pool, double start_seconds, OutputBuffer& out);
+
+// Formats samples on a dedicated thread and writes them to stdout (perf
+// script) and stderr (debug), so output I/O never delays the next sample.
+class AsyncSampleWriter {
+public:
+    static const size_t FLUSH_THRESHOLD = 1 << 20;
+
+    AsyncSampleWriter(StringPool& string_pool, OutputOptions options, size_t queue_capacity);
+    AsyncSampleWriter(const AsyncSampleWriter&) = delete;
+    ~AsyncSampleWriter();
+
+    // Never blocks. If the writer has fallen behind the sample is dropped
+    // (and counted) and false is returned.
+    bool submit(ProcessSample&& process_sample);
+    // Takes back a sample the writer is done with, so that its buffers are
+    // reused for the next one. Returns false if there is none yet.
+    bool reuse(ProcessSample& process_sample) { return recycled.try_pop(process_sample); }
+    // Writes out everything submitted so far and stops the writer thread.
+    void finish();
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    StringPool& string_pool;
+    OutputOptions options;
+    SpscQueue<ProcessSample> queue;
+    // Written samples going back to the sampling thread, see reuse().
+    SpscQueue<ProcessSample> recycled;
+    std::atomic<uint64_t> dropped_ { 0 };
+    std::atomic<bool> stopping { false };
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::thread thread;
+
+    void run();
+    void dump_collapsed(const StackAggregator& aggregator);
+};
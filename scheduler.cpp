@@ -0,0 +1,70 @@
+#include <errno.h>
+
+#include "scheduler.hpp"
+
+uint64_t monotonic_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000;
+    deadline.tv_nsec = deadline_ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+    }
+}
+
+SampleScheduler::SampleScheduler(uint64_t period_ns, OverrunPolicy policy)
+    : period_ns_(period_ns == 0 ? 1 : period_ns), policy(policy), jitter_histogram(MAX_TRACKED_JITTER_US + 2, 0) {}
+
+uint64_t SampleScheduler::wait() {
+    uint64_t now = monotonic_now_ns();
+    if (stats_.ticks == 0) {
+        next_deadline = now;
+    }
+
+    uint64_t deadline = next_deadline;
+    if (now >= deadline + period_ns_) {
+        // The previous sample overran at least one whole period.
+        if (policy == OverrunPolicy::Skip) {
+            uint64_t missed = (now - deadline) / period_ns_;
+            stats_.missed_ticks += missed;
+            deadline += missed * period_ns_;
+        } else {
+            ++stats_.missed_ticks;
+        }
+    }
+
+    if (now < deadline) {
+        sleep_until_ns(deadline);
+        now = monotonic_now_ns();
+    }
+
+    uint64_t jitter_us = (now - deadline) / 1000;
+    ++jitter_histogram[jitter_us <= MAX_TRACKED_JITTER_US ? jitter_us : MAX_TRACKED_JITTER_US + 1];
+    if (jitter_us > max_jitter_us_) {
+        max_jitter_us_ = jitter_us;
+    }
+
+    ++stats_.ticks;
+    next_deadline = deadline + period_ns_;
+    return deadline;
+}
+
+uint64_t SampleScheduler::jitter_percentile_us(double q) const {
+    uint64_t rank = (uint64_t) (q * stats_.ticks + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < jitter_histogram.size(); ++i) {
+        seen += jitter_histogram[i];
+        if (seen >= rank) {
+            return i <= MAX_TRACKED_JITTER_US ? i : max_jitter_us_;
+        }
+    }
+    return max_jitter_us_;
+}
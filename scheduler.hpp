@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <time.h>
+
+// What to do with ticks whose deadline passed while the previous sample was
+// still being taken.
+enum class OverrunPolicy {
+    // Take the late samples back to back until the schedule is met again.
+    CatchUp,
+    // Drop them and continue with the next deadline in the future.
+    Skip,
+};
+
+// Absolute-deadline tick source: deadlines are start + n * period on
+// CLOCK_MONOTONIC and are waited for with clock_nanosleep(TIMER_ABSTIME),
+// so sampling overhead and sleep overshoot do not accumulate into drift.
+class SampleScheduler {
+public:
+    // Jitter is recorded with microsecond resolution up to this value.
+    static const uint64_t MAX_TRACKED_JITTER_US = 10000;
+
+    struct Stats {
+        uint64_t ticks = 0;
+        // Ticks that were at least a whole period late: dropped with
+        // OverrunPolicy::Skip, taken late with OverrunPolicy::CatchUp.
+        uint64_t missed_ticks = 0;
+    };
+
+    SampleScheduler(uint64_t period_ns, OverrunPolicy policy);
+    SampleScheduler(const SampleScheduler&) = delete;
+
+    // Sleeps until the next tick; the first call returns immediately.
+    // Returns the deadline of the tick in CLOCK_MONOTONIC nanoseconds.
+    uint64_t wait();
+
+    uint64_t period_ns() const { return period_ns_; }
+    const Stats& stats() const { return stats_; }
+    // Lateness of wake-ups relative to their deadlines, 0 < q <= 1.
+    uint64_t jitter_percentile_us(double q) const;
+    uint64_t max_jitter_us() const { return max_jitter_us_; }
+
+private:
+    uint64_t period_ns_;
+    OverrunPolicy policy;
+    uint64_t next_deadline = 0;
+    Stats stats_;
+    // jitter_histogram[i] counts wake-ups late by i microseconds; the last
+    // bucket collects everything above MAX_TRACKED_JITTER_US.
+    std::vector<uint64_t> jitter_histogram;
+    uint64_t max_jitter_us_ = 0;
+};
+
+uint64_t monotonic_now_ns();
+// clock_nanosleep(TIMER_ABSTIME) until `deadline_ns`, restarted on EINTR.
+void sleep_until_ns(uint64_t deadline_ns);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <stddef.h>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots(round_up_to_power_of_two(capacity + 1)), mask(slots.size() - 1) {}
+    SpscQueue(const SpscQueue&) = delete;
+
+    // Returns false (leaving `value` untouched) if the queue is full.
+    bool try_push(T&& value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) & mask;
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        slots[tail] = std::move(value);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = std::move(slots[head]);
+        head_.store((head + 1) & mask, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    // Separate cache lines, so that producer and consumer don't false-share.
+    alignas(64) std::atomic<size_t> head_ { 0 };
+    alignas(64) std::atomic<size_t> tail_ { 0 };
+
+    static size_t round_up_to_power_of_two(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+};
@@ -0,0 +1,123 @@
+#include <utility>
+#include <algorithm>
+
+#include "stack_aggregator.hpp"
+
+static uint64_t hash_name_ids(const uint64_t* name_ids, size_t length) {
+    // FNV-1a over whole words, with a final avalanche (from splitmix64).
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= name_ids[i];
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= hash >> 31;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+StackAggregator::StackAggregator(StringPool& string_pool, bool group_by_thread, size_t max_stacks)
+    : string_pool(string_pool), group_by_thread(group_by_thread), max_stacks(max_stacks), index(1024, 0) {
+    unknown_name_id = string_pool.intern("[unknown]");
+    truncated_name_id = string_pool.intern("[truncated]");
+}
+
+uint32_t StackAggregator::intern(const uint64_t* ids, size_t length) {
+    uint64_t hash = hash_name_ids(ids, length);
+    size_t mask = index.size() - 1;
+
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        uint32_t value = index[slot];
+        if (value == 0) {
+            bool is_truncated_stack = length == 1 && ids[0] == truncated_name_id;
+            if (max_stacks != 0 && entries.size() >= max_stacks && !is_truncated_stack) {
+                // One per truncated sample when called through add().
+                ++truncated_samples_;
+                return intern(&truncated_name_id, 1);
+            }
+            uint32_t stack_id = entries.size();
+            entries.push_back(Entry { hash, 0, (uint32_t) name_ids.size(), (uint32_t) length });
+            name_ids.insert(name_ids.end(), ids, ids + length);
+            index[slot] = stack_id + 1;
+            if (entries.size() * 2 > index.size()) {
+                grow_index();
+            }
+            return stack_id;
+        }
+
+        const Entry& entry = entries[value - 1];
+        if (entry.hash == hash && entry.length == length
+                && std::equal(ids, ids + length, name_ids.begin() + entry.offset)) {
+            return value - 1;
+        }
+    }
+}
+
+uint32_t StackAggregator::intern(const ThreadSample& thread_sample, uint64_t process_tag_id) {
+    scratch.clear();
+    if (process_tag_id != StackFrame::NO_NAME) {
+        scratch.push_back(process_tag_id);
+    }
+    if (group_by_thread) {
+        scratch.push_back(thread_sample.thread_name_id);
+    }
+    for (auto it = thread_sample.frames.rbegin(); it != thread_sample.frames.rend(); ++it) {
+        scratch.push_back(it->name_id == StackFrame::NO_NAME ? unknown_name_id : it->name_id);
+    }
+    return intern(scratch.data(), scratch.size());
+}
+
+void StackAggregator::grow_index() {
+    std::vector<uint32_t> new_index(index.size() * 2, 0);
+    size_t mask = new_index.size() - 1;
+    for (uint32_t stack_id = 0; stack_id < entries.size(); ++stack_id) {
+        size_t slot = entries[stack_id].hash & mask;
+        while (new_index[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        new_index[slot] = stack_id + 1;
+    }
+    index = std::move(new_index);
+}
+
+size_t StackAggregator::memory_bytes() const {
+    return name_ids.capacity() * sizeof(uint64_t)
+        + entries.capacity() * sizeof(Entry)
+        + index.capacity() * sizeof(uint32_t);
+}
+
+void append_folded_frame(OutputBuffer& out, std::string_view name) {
+    size_t start = 0;
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        if (c == ';' || c == '\n') {
+            out.append(name.substr(start, i - start)).append(c == ';' ? ':' : ' ');
+            start = i + 1;
+        }
+    }
+    out.append(name.substr(start));
+}
+
+void StackAggregator::write_folded(OutputBuffer& out) const {
+    for (const auto& entry: entries) {
+        if (entry.count == 0) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < entry.length; ++i) {
+            if (i > 0) {
+                out.append(';');
+            }
+            append_folded_frame(out, string_pool.get_by_id(name_ids[entry.offset + i]));
+        }
+        out.append(' ').append_dec(entry.count).append('\n');
+    }
+}
+
+void StackAggregator::clear() {
+    name_ids.clear();
+    entries.clear();
+    std::fill(index.begin(), index.end(), 0);
+    total_samples_ = 0;
+    truncated_samples_ = 0;
+}
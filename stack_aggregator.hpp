@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "stringpool.hpp"
+#include "output_buffer.hpp"
+#include "backtrace.hpp"
+
+// Counts identical stacks, keyed by their sequence of interned frame names
+// (outermost frame first). Memory grows with the number of distinct stacks,
+// not with the number of samples.
+class StackAggregator {
+public:
+    static const uint32_t NO_STACK = (uint32_t) -1;
+
+    // With `group_by_thread` the thread name becomes the root frame. If
+    // `max_stacks` is not 0, stacks beyond it are all counted as a single
+    // "[truncated]" stack, which bounds memory_bytes().
+    StackAggregator(StringPool& string_pool, bool group_by_thread, size_t max_stacks = 0);
+
+    // Returns the id of the stack, adding it (with a zero count) if needed.
+    uint32_t intern(const uint64_t* name_ids, size_t length);
+    // `process_tag_id`, if set, becomes the root frame (above the thread name).
+    uint32_t intern(const ThreadSample& thread_sample, uint64_t process_tag_id = StackFrame::NO_NAME);
+    void add(uint32_t stack_id, uint64_t count = 1) {
+        entries[stack_id].count += count;
+        total_samples_ += count;
+    }
+    void add(const ThreadSample& thread_sample, uint64_t process_tag_id = StackFrame::NO_NAME) {
+        add(intern(thread_sample, process_tag_id));
+    }
+
+    size_t distinct_stacks() const { return entries.size(); }
+    // Samples counted as "[truncated]", see max_stacks.
+    uint64_t truncated_samples() const { return truncated_samples_; }
+    uint64_t total_samples() const { return total_samples_; }
+    uint64_t count(uint32_t stack_id) const { return entries[stack_id].count; }
+    // Frames of a stack, outermost first.
+    const uint64_t* frames(uint32_t stack_id, size_t& length) const {
+        length = entries[stack_id].length;
+        return name_ids.data() + entries[stack_id].offset;
+    }
+    size_t memory_bytes() const;
+
+    // FlameGraph "folded" format: "outer;...;leaf count" per line.
+    void write_folded(OutputBuffer& out) const;
+    // Forgets all stacks but keeps the memory, for the next window.
+    void clear();
+
+private:
+    struct Entry {
+        uint64_t hash;
+        uint64_t count;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    StringPool& string_pool;
+    bool group_by_thread;
+    size_t max_stacks;
+    uint64_t unknown_name_id;
+    uint64_t truncated_name_id;
+    std::vector<uint64_t> name_ids;
+    std::vector<Entry> entries;
+    // Open addressing over `entries`; 0 is an empty slot, otherwise index + 1.
+    std::vector<uint32_t> index;
+    std::vector<uint64_t> scratch;
+    uint64_t total_samples_ = 0;
+    uint64_t truncated_samples_ = 0;
+
+    void grow_index();
+};
+
+// Writes `name` as a folded-stack frame: ';' separates frames and a newline
+// ends the record, so both are replaced.
+void append_folded_frame(OutputBuffer& out, std::string_view name);
@@ -0,0 +1,45 @@
+#include <utility>
+#include <algorithm>
+
+#include "stack_cache.hpp"
+
+using std::vector;
+
+void StackSuffixCache::begin() {
+    next.clear();
+}
+
+bool StackSuffixCache::splice(RemoteMemory& memory, uintptr_t ip, uintptr_t sp, vector<uintptr_t>& ips) {
+    // Leaf first, so sp grows along the cached stack.
+    auto it = std::lower_bound(previous.begin(), previous.end(), sp, [](const Frame& frame, uintptr_t value) {
+        return frame.sp < value;
+    });
+    // The cached leaf is not a candidate: its ip is not a return address.
+    if (it == previous.end() || it == previous.begin() || it->sp != sp || it->ip != ip) {
+        return false;
+    }
+
+    for (auto caller = it + 1; caller != previous.end(); ++caller) {
+        uint64_t return_address;
+        if (!memory.read_word(caller->sp - sizeof(uint64_t), return_address) || return_address != caller->ip) {
+            return false;
+        }
+    }
+
+    for (auto frame = it; frame != previous.end(); ++frame) {
+        next.push_back(*frame);
+        ips.push_back(frame->ip);
+    }
+    spliced_frames_ += previous.end() - it;
+    return true;
+}
+
+void StackSuffixCache::commit() {
+    std::swap(previous, next);
+    next.clear();
+}
+
+void StackSuffixCache::clear() {
+    previous.clear();
+    next.clear();
+}
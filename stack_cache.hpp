@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "remote_memory.hpp"
+
+// The previous stack of one thread as (ip, sp) pairs, leaf first, so that
+// the next unwind can stop as soon as it reaches a frame that has not
+// changed since and reuse ("splice") the rest.
+//
+// A frame is reused only if its (ip, sp) match and every return address of
+// the cached caller chain is still in place: on x86-64 the return address
+// into frame i + 1 is stored just below frame i + 1's sp. Those words
+// usually sit on a few stack pages that RemoteMemory reads in bulk, which is
+// far cheaper than stepping through the frames again.
+class StackSuffixCache {
+public:
+    struct Frame {
+        uintptr_t ip;
+        uintptr_t sp;
+    };
+
+    // Starts recording a new stack.
+    void begin();
+    // Appends a freshly unwound frame.
+    void push(uintptr_t ip, uintptr_t sp) { next.push_back(Frame { ip, sp }); }
+    // If the non-leaf frame (ip, sp) and its callers are unchanged, appends
+    // them to the new stack and to `ips` and returns true.
+    bool splice(RemoteMemory& memory, uintptr_t ip, uintptr_t sp, std::vector<uintptr_t>& ips);
+    // Makes the recorded stack the reference for the next unwind.
+    void commit();
+    // Forgets the cached stack, e.g. after a failed unwind.
+    void clear();
+
+    uint64_t spliced_frames() const { return spliced_frames_; }
+
+private:
+    std::vector<Frame> previous;
+    std::vector<Frame> next;
+    uint64_t spliced_frames_ = 0;
+};
@@ -0,0 +1,154 @@
+#include <string.h>
+
+#include "stringpool.hpp"
+
+StringPool::Table::Table(size_t size) : mask(size - 1), slots(new std::atomic<uint64_t>[size]) {
+    for (size_t i = 0; i < size; ++i) {
+        slots[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+StringPool::StringPool() {
+    for (auto& segment: segments) {
+        segment.store(nullptr, std::memory_order_relaxed);
+    }
+    tables.push_back(std::make_unique<Table>(1 << 12));
+    table.store(tables.back().get(), std::memory_order_release);
+}
+
+StringPool::~StringPool() {
+    for (auto& segment: segments) {
+        delete[] segment.load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t StringPool::hash_string(std::string_view data) {
+    // FNV-1a with a final mix, so that both halves are usable (index and tag).
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c: data) {
+        hash = (hash ^ (uint8_t) c) * 1099511628211ULL;
+    }
+    hash ^= hash >> 29;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t StringPool::find(const Table& table, std::string_view data, uint64_t hash) const {
+    uint64_t tag = hash >> 32;
+    for (size_t slot = hash & table.mask;; slot = (slot + 1) & table.mask) {
+        uint64_t value = table.slots[slot].load(std::memory_order_acquire);
+        if (value == 0) {
+            return 0;
+        }
+        if ((value >> 32) != tag) {
+            continue;
+        }
+        uint64_t id = (value & 0xffffffff) - 1;
+        const Entry& candidate = entry(id);
+        if (candidate.length == data.size() && memcmp(candidate.data, data.data(), data.size()) == 0) {
+            return id + 1;
+        }
+    }
+}
+
+const char* StringPool::copy_to_arena(std::string_view data) {
+    size_t size = data.size() + 1;
+    if (size > chunk_left) {
+        // Large strings get a chunk of their own, so the current one is not wasted.
+        size_t chunk_size = size > ARENA_CHUNK_SIZE / 4 ? size : ARENA_CHUNK_SIZE;
+        chunks.emplace_back(new char[chunk_size]);
+        arena_bytes += chunk_size;
+        if (chunk_size != ARENA_CHUNK_SIZE) {
+            char* result = chunks.back().get();
+            memcpy(result, data.data(), data.size());
+            result[data.size()] = '\0';
+            return result;
+        }
+        chunk_position = chunks.back().get();
+        chunk_left = chunk_size;
+    }
+
+    char* result = chunk_position;
+    memcpy(result, data.data(), data.size());
+    result[data.size()] = '\0';
+    chunk_position += size;
+    chunk_left -= size;
+    return result;
+}
+
+void StringPool::grow_table() {
+    const Table* old_table = table.load(std::memory_order_relaxed);
+    auto new_table = std::make_unique<Table>((old_table->mask + 1) * 2);
+    size_t strings = count.load(std::memory_order_relaxed);
+    for (uint64_t id = 0; id < strings; ++id) {
+        uint64_t hash = entry(id).hash;
+        size_t slot = hash & new_table->mask;
+        while (new_table->slots[slot].load(std::memory_order_relaxed) != 0) {
+            slot = (slot + 1) & new_table->mask;
+        }
+        new_table->slots[slot].store(((hash >> 32) << 32) | (id + 1), std::memory_order_relaxed);
+    }
+
+    // Readers may still probe the old table; it is kept until the pool is
+    // destroyed. A miss there only sends them to the locked path.
+    table.store(new_table.get(), std::memory_order_release);
+    tables.push_back(std::move(new_table));
+}
+
+uint64_t StringPool::intern(std::string_view data) {
+    uint64_t hash = hash_string(data);
+    uint64_t found = find(*table.load(std::memory_order_acquire), data, hash);
+    if (found != 0) {
+        return found - 1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Table* current = table.load(std::memory_order_relaxed);
+    found = find(*current, data, hash);
+    if (found != 0) {
+        return found - 1;
+    }
+
+    uint64_t id = count.load(std::memory_order_relaxed);
+    uint64_t n = id + (1ULL << FIRST_SEGMENT_BITS);
+    size_t bit = 63 - __builtin_clzll(n);
+    Entry* segment = segments[bit - FIRST_SEGMENT_BITS].load(std::memory_order_relaxed);
+    if (segment == nullptr) {
+        segment = new Entry[1ULL << bit];
+        segments[bit - FIRST_SEGMENT_BITS].store(segment, std::memory_order_release);
+    }
+    // key by the pooled copy: `data` may point into the caller's buffer
+    segment[n - (1ULL << bit)] = Entry { copy_to_arena(data), (uint32_t) data.size(), hash };
+    string_bytes += data.size();
+    count.store(id + 1, std::memory_order_release);
+
+    size_t slot = hash & current->mask;
+    while (current->slots[slot].load(std::memory_order_relaxed) != 0) {
+        slot = (slot + 1) & current->mask;
+    }
+    // Publishes the entry written above to lock-free readers.
+    current->slots[slot].store(((hash >> 32) << 32) | (id + 1), std::memory_order_release);
+
+    if ((id + 1) * 2 > current->mask + 1) {
+        grow_table();
+    }
+    return id;
+}
+
+StringPool::Stats StringPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result;
+    result.strings = count.load(std::memory_order_relaxed);
+    result.string_bytes = string_bytes;
+    result.memory_bytes = arena_bytes;
+    for (size_t k = 0; k < MAX_SEGMENTS; ++k) {
+        if (segments[k].load(std::memory_order_relaxed) != nullptr) {
+            result.memory_bytes += (1ULL << (k + FIRST_SEGMENT_BITS)) * sizeof(Entry);
+        }
+    }
+    for (const auto& retained: tables) {
+        result.memory_bytes += (retained->mask + 1) * sizeof(std::atomic<uint64_t>);
+    }
+    return result;
+}
@@ -1,40 +1,90 @@
 #pragma once
 
 #include <vector>
-#include <string>
-#include <unordered_map>
 #include <string_view>
 #include <memory>
-#include <utility>
-#include <shared_mutex>
-
-struct StringPool {
-    std::shared_mutex mutex;
-    std::vector<std::unique_ptr<std::string>> strings;
-    std::unordered_map<std::string_view, uint64_t> map;
-
-    uint64_t intern(std::string_view data) {
-        std::shared_lock<std::shared_mutex> shared_lock(mutex);
-        auto it = map.find(data);
-        if (it != map.end()) {
-            return it->second;
-        } else {
-            shared_lock.unlock();
-
-            std::unique_lock<std::shared_mutex> unique_lock(mutex);
-            it = map.find(data);
-            if (it != map.end()) {
-                return it->second;
-            } else {
-                uint64_t new_id = strings.size();
-                map[data] = new_id;
-                strings.push_back(std::make_unique<std::string>(data));
-                return new_id;
-            }
-        }
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+// Interns strings into dense ids, from any number of threads.
+//
+// Strings are copied into bump-allocated arena chunks and never move. The
+// id -> string table is split into segments of doubling size, so it grows
+// without relocating entries and get_by_id() is a lock-free O(1) load.
+// intern() of a string that is already in the pool is a lock-free probe of
+// a flat open-addressing table; only adding a new string takes the mutex.
+class StringPool {
+public:
+    struct Stats {
+        uint64_t strings = 0;
+        // Sum of the string lengths.
+        uint64_t string_bytes = 0;
+        // Everything the pool allocated: arena chunks, entries and tables,
+        // including tables retired by growth.
+        uint64_t memory_bytes = 0;
+    };
+
+    StringPool();
+    StringPool(const StringPool&) = delete;
+    ~StringPool();
+
+    uint64_t intern(std::string_view data);
+
+    // `name_id` must have been returned by intern(). The result is
+    // NUL-terminated and stays valid for the lifetime of the pool.
+    std::string_view get_by_id(uint64_t name_id) const {
+        const Entry& entry = this->entry(name_id);
+        return std::string_view(entry.data, entry.length);
     }
 
-    std::string_view get_by_id(uint64_t name_id) {
-        return *strings[name_id];
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    Stats stats() const;
+
+private:
+    struct Entry {
+        const char* data;
+        uint32_t length;
+        uint64_t hash;
+    };
+    // Slots hold (upper 32 bits of the hash) << 32 | (id + 1); 0 is empty.
+    struct Table {
+        size_t mask;
+        std::unique_ptr<std::atomic<uint64_t>[]> slots;
+
+        explicit Table(size_t size);
+    };
+
+    static const size_t FIRST_SEGMENT_BITS = 10;
+    static const size_t MAX_SEGMENTS = 40;
+    static const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+    // Segment k holds ids [2^(k + FIRST_SEGMENT_BITS) - 2^FIRST_SEGMENT_BITS, ...).
+    std::atomic<Entry*> segments[MAX_SEGMENTS];
+    std::atomic<size_t> count { 0 };
+    std::atomic<Table*> table;
+
+    // Guards everything below and all writes above.
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Table>> tables;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* chunk_position = nullptr;
+    size_t chunk_left = 0;
+    uint64_t arena_bytes = 0;
+    uint64_t string_bytes = 0;
+
+    static uint64_t hash_string(std::string_view data);
+
+    const Entry& entry(uint64_t id) const {
+        uint64_t n = id + (1ULL << FIRST_SEGMENT_BITS);
+        size_t bit = 63 - __builtin_clzll(n);
+        const Entry* segment = segments[bit - FIRST_SEGMENT_BITS].load(std::memory_order_acquire);
+        return segment[n - (1ULL << bit)];
     }
-};
\ No newline at end of file
+
+    // Returns the id + 1 of `data`, or 0 if `table` does not have it.
+    uint64_t find(const Table& table, std::string_view data, uint64_t hash) const;
+    const char* copy_to_arena(std::string_view data);
+    void grow_table();
+};
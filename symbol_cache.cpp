@@ -0,0 +1,183 @@
+#include <utility>
+#include <algorithm>
+
+#include "symbol_cache.hpp"
+
+using std::vector;
+
+static uintptr_t make_key(uintptr_t ip, bool leaf) {
+    // User space addresses leave the top bit free.
+    return (ip << 1) | (leaf ? 1 : 0);
+}
+
+static uint64_t hash_key(uintptr_t key) {
+    return key * 0x9E3779B97F4A7C15ull;
+}
+
+static size_t shard_index(uint64_t hash) {
+    return hash >> 60;
+}
+
+static size_t slot_index(uint64_t hash, size_t capacity) {
+    return (hash >> 16) & (capacity - 1);
+}
+
+SymbolCache::SymbolCache() {
+    for (auto& shard: shards) {
+        shard.entries.assign(INITIAL_SHARD_CAPACITY, Entry {});
+    }
+}
+
+bool SymbolCache::lookup(uintptr_t ip, bool leaf, Symbol& symbol) {
+    uintptr_t key = make_key(ip, leaf);
+    uint64_t hash = hash_key(key);
+    Shard& shard = shards[shard_index(hash)];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t mask = shard.entries.size() - 1;
+    for (size_t i = slot_index(hash, shard.entries.size());; i = (i + 1) & mask) {
+        const Entry& entry = shard.entries[i];
+        if (entry.key == 0) {
+            return false;
+        }
+        if (entry.key == key) {
+            symbol = entry.symbol;
+            return true;
+        }
+    }
+}
+
+void SymbolCache::insert_into(vector<Entry>& entries, const Entry& entry) {
+    size_t mask = entries.size() - 1;
+    for (size_t i = slot_index(hash_key(entry.key), entries.size());; i = (i + 1) & mask) {
+        if (entries[i].key == 0 || entries[i].key == entry.key) {
+            entries[i] = entry;
+            return;
+        }
+    }
+}
+
+void SymbolCache::insert(uintptr_t ip, bool leaf, const Symbol& symbol) {
+    uintptr_t key = make_key(ip, leaf);
+    if (key == 0) {
+        return;
+    }
+    uint64_t hash = hash_key(key);
+    Shard& shard = shards[shard_index(hash)];
+    Entry entry { key, symbol };
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.size >= MAX_SHARD_ENTRIES) {
+        shard.entries.assign(INITIAL_SHARD_CAPACITY, Entry {});
+        shard.size = 0;
+    }
+
+    // Keep the load factor at or below 1/2.
+    if ((shard.size + 1) * 2 > shard.entries.size()) {
+        vector<Entry> grown(shard.entries.size() * 2, Entry {});
+        for (const auto& old: shard.entries) {
+            if (old.key != 0) {
+                insert_into(grown, old);
+            }
+        }
+        shard.entries = std::move(grown);
+    }
+
+    size_t mask = shard.entries.size() - 1;
+    for (size_t i = slot_index(hash, shard.entries.size());; i = (i + 1) & mask) {
+        Entry& slot = shard.entries[i];
+        if (slot.key == 0) {
+            slot = entry;
+            ++shard.size;
+            return;
+        }
+        if (slot.key == key) {
+            slot = entry;
+            return;
+        }
+    }
+}
+
+template <typename Contains>
+void SymbolCache::invalidate_if(Contains&& contains) {
+    for (auto& shard: shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        bool found = false;
+        for (const auto& entry: shard.entries) {
+            if (entry.key != 0 && contains(entry.key >> 1)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            continue;
+        }
+
+        // Linear probing has no cheap delete, rebuild the shard instead.
+        vector<Entry> rebuilt(shard.entries.size(), Entry {});
+        size_t size = 0;
+        for (const auto& entry: shard.entries) {
+            if (entry.key != 0 && !contains(entry.key >> 1)) {
+                insert_into(rebuilt, entry);
+                ++size;
+            }
+        }
+        shard.entries = std::move(rebuilt);
+        shard.size = size;
+    }
+}
+
+void SymbolCache::invalidate(uintptr_t start, uintptr_t end) {
+    invalidate_if([&](uintptr_t ip) {
+        return ip >= start && ip < end;
+    });
+}
+
+void SymbolCache::invalidate(vector<Range>& ranges) {
+    if (ranges.empty()) {
+        return;
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b) {
+        return a.start < b.start;
+    });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].start <= ranges[merged].end) {
+            ranges[merged].end = std::max(ranges[merged].end, ranges[i].end);
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    ranges.resize(merged + 1);
+
+    invalidate_if([&](uintptr_t ip) {
+        auto it = std::upper_bound(ranges.begin(), ranges.end(), ip, [](uintptr_t ip, const Range& range) {
+            return ip < range.start;
+        });
+        return it != ranges.begin() && ip < (it - 1)->end;
+    });
+}
+
+void SymbolCache::add_stats(const Stats& stats) {
+    hits.fetch_add(stats.hits, std::memory_order_relaxed);
+    misses.fetch_add(stats.misses, std::memory_order_relaxed);
+    resolve_nanoseconds.fetch_add(stats.resolve_nanoseconds, std::memory_order_relaxed);
+}
+
+SymbolCache::Stats SymbolCache::stats() const {
+    Stats result;
+    result.hits = hits.load(std::memory_order_relaxed);
+    result.misses = misses.load(std::memory_order_relaxed);
+    result.resolve_nanoseconds = resolve_nanoseconds.load(std::memory_order_relaxed);
+    return result;
+}
+
+size_t SymbolCache::size() const {
+    size_t result = 0;
+    for (const auto& shard: shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        result += shard.size;
+    }
+    return result;
+}
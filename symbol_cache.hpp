@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+// Session-wide cache of resolved frame names, keyed by IP. Checked before
+// libunwind (remote ELF lookup) and PerfSymbolMap.
+//
+// The table is split into shards, each a flat open-addressing hash with
+// linear probing behind its own mutex, so sampling workers rarely contend.
+//
+// Entries stay valid until invalidate() drops their address range: that of
+// a mapping that went away, or that of new perf map lines (which may name,
+// or rename, addresses that were cached before).
+class SymbolCache {
+public:
+    static const size_t SHARDS = 16;
+    static const size_t INITIAL_SHARD_CAPACITY = 1024;
+    // A shard that reaches this many entries is cleared instead of growing.
+    static const size_t MAX_SHARD_ENTRIES = 1 << 16;
+
+    struct Symbol {
+        uint64_t name_id;
+        uintptr_t name_offset;
+        uint64_t module_id;
+    };
+
+    struct Entry {
+        uintptr_t key;
+        Symbol symbol;
+    };
+
+    struct Range {
+        uintptr_t start;
+        uintptr_t end;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t resolve_nanoseconds = 0;
+    };
+
+    SymbolCache();
+    SymbolCache(const SymbolCache&) = delete;
+
+    // Leaf frames are resolved by their own IP, others by the preceding
+    // instruction, so they are cached separately.
+    bool lookup(uintptr_t ip, bool leaf, Symbol& symbol);
+    void insert(uintptr_t ip, bool leaf, const Symbol& symbol);
+    // Drops entries for IPs in [start, end).
+    void invalidate(uintptr_t start, uintptr_t end);
+    // Drops entries for IPs in any of `ranges`, in a single pass over the
+    // table. Sorts and merges `ranges` in place.
+    void invalidate(std::vector<Range>& ranges);
+
+    // Callers accumulate counters locally and add them once per thread sample.
+    void add_stats(const Stats& stats);
+    Stats stats() const;
+    size_t size() const;
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::vector<Entry> entries;
+        size_t size = 0;
+    };
+
+    Shard shards[SHARDS];
+    std::atomic<uint64_t> hits { 0 };
+    std::atomic<uint64_t> misses { 0 };
+    std::atomic<uint64_t> resolve_nanoseconds { 0 };
+
+    static void insert_into(std::vector<Entry>& entries, const Entry& entry);
+    template <typename Contains>
+    void invalidate_if(Contains&& contains);
+};
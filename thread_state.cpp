@@ -0,0 +1,244 @@
+#include <string>
+#include <unordered_set>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "thread_state.hpp"
+
+using std::string;
+using std::vector;
+
+static const size_t DIRENT_BUFFER_SIZE = 32 * 1024;
+
+// Only used for refresh intervals, where a few ms of error do not matter.
+static uint64_t coarse_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+ThreadLister::ThreadLister(pid_t pid) : pid(pid) {}
+
+ThreadLister::~ThreadLister() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+Result<bool, string> ThreadLister::refresh() {
+    if (fd < 0) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+        fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                bool changed = !tids_.empty();
+                tids_.clear();
+                return ResultInit::ok(bool(changed));
+            }
+            int errno_copy = errno;
+            return ResultInit::err(string("open(") + path + ") failed: errno = " + std::to_string(errno_copy) + " message = " + strerror(errno_copy));
+        }
+        buffer.resize(DIRENT_BUFFER_SIZE);
+    }
+
+    uint64_t now_ns = coarse_now_ns();
+    struct stat task_stat;
+    if (fstat(fd, &task_stat) != 0) {
+        // Let the directory read report the error, if any.
+        stale = true;
+    } else if (task_stat.st_nlink != link_count) {
+        link_count = task_stat.st_nlink;
+        stale = true;
+    }
+    if (!stale && now_ns - scanned_at_ns < RESCAN_INTERVAL_NS) {
+        return ResultInit::ok(false);
+    }
+
+    auto scan_result = scan();
+    if (!scan_result.isOk()) {
+        return scan_result;
+    }
+    stale = false;
+    scanned_at_ns = now_ns;
+    ++rescans_;
+
+    if (scanned == tids_) {
+        return ResultInit::ok(false);
+    }
+    // Copied rather than swapped, so both keep their capacity.
+    tids_ = scanned;
+    return ResultInit::ok(true);
+}
+
+Result<bool, string> ThreadLister::scan() {
+    scanned.clear();
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        int errno_copy = errno;
+        return ResultInit::err(string("lseek(/proc/") + std::to_string(pid) + "/task) failed: errno = " + std::to_string(errno_copy) + " message = " + strerror(errno_copy));
+    }
+
+    while (true) {
+        // struct dirent64 has the kernel's linux_dirent64 layout.
+        long rc = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOENT || errno == ESRCH) {
+                // the process has exited
+                scanned.clear();
+                return ResultInit::ok(false);
+            }
+            int errno_copy = errno;
+            return ResultInit::err(string("getdents64(/proc/") + std::to_string(pid) + "/task) failed: errno = " + std::to_string(errno_copy) + " message = " + strerror(errno_copy));
+        }
+        if (rc == 0) {
+            break;
+        }
+
+        for (long offset = 0; offset < rc;) {
+            const auto* entry = reinterpret_cast<const struct dirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            int tid = atoi(entry->d_name);
+            if (tid != 0) {
+                scanned.push_back(tid);
+            }
+        }
+    }
+
+    return ResultInit::ok(true);
+}
+
+ThreadProcFiles::Files::~Files() {
+    for (int fd: { stat_fd, wchan_fd, comm_fd, schedstat_fd }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+ThreadProcFiles::ThreadProcFiles(pid_t pid) : pid(pid) {}
+
+ThreadProcFiles::Files* ThreadProcFiles::get(pid_t tid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = files[tid];
+    if (!entry) {
+        entry = std::make_unique<Files>();
+    }
+    return entry.get();
+}
+
+ssize_t ThreadProcFiles::read_file(int& fd, pid_t tid, const char* name, char* buffer, size_t size) {
+    if (fd < 0) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/%s", (int) pid, (int) tid, name);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+    }
+
+    ssize_t rc;
+    do {
+        rc = pread(fd, buffer, size - 1, 0);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0) {
+        return -1;
+    }
+    buffer[rc] = '\0';
+    return rc;
+}
+
+bool ThreadProcFiles::read_state(pid_t tid, StringPool& string_pool, ThreadState& state) {
+    Files* thread_files = get(tid);
+    char buffer[1024];
+
+    if (read_file(thread_files->stat_fd, tid, "stat", buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    // "tid (comm) S ..." where comm itself may contain ')'
+    const char* comm_end = strrchr(buffer, ')');
+    if (comm_end == nullptr || comm_end[1] != ' ' || comm_end[2] == '\0') {
+        return false;
+    }
+    state.run_state = comm_end[2];
+
+    ssize_t length = read_file(thread_files->wchan_fd, tid, "wchan", buffer, sizeof(buffer));
+    if (length > 0 && strcmp(buffer, "0") != 0) {
+        state.wchan_id = string_pool.intern(std::string_view(buffer, length));
+    }
+
+    return true;
+}
+
+bool ThreadProcFiles::read_schedstat(pid_t tid, SchedStat& schedstat) {
+    Files* thread_files = get(tid);
+    char buffer[128];
+
+    // "run_time_ns wait_time_ns timeslices\n"
+    if (read_file(thread_files->schedstat_fd, tid, "schedstat", buffer, sizeof(buffer)) <= 0) {
+        return false;
+    }
+    unsigned long long run_time_ns, wait_time_ns, timeslices;
+    if (sscanf(buffer, "%llu %llu %llu", &run_time_ns, &wait_time_ns, &timeslices) != 3) {
+        return false;
+    }
+    schedstat.run_time_ns = run_time_ns;
+    schedstat.timeslices = timeslices;
+    return true;
+}
+
+uint64_t ThreadProcFiles::read_name(pid_t tid, StringPool& string_pool) {
+    Files* thread_files = get(tid);
+    // Entries are only used by the worker that owns the thread, see sample_process().
+    uint64_t now_ns = coarse_now_ns();
+    if (thread_files->has_name && now_ns - thread_files->name_read_at_ns < NAME_REFRESH_NS) {
+        return thread_files->name_id;
+    }
+    char buffer[64];
+
+    ssize_t length = read_file(thread_files->comm_fd, tid, "comm", buffer, sizeof(buffer));
+    // Failures are not cached, the next sample tries again.
+    thread_files->has_name = length >= 0;
+    if (length < 0) {
+        length = 0;
+    }
+    if (length > 0 && buffer[length - 1] == '\n') {
+        --length;
+    }
+    for (ssize_t i = 0; i < length; ++i) {
+        if (buffer[i] == ' ') {
+            buffer[i] = '_';
+        }
+    }
+    thread_files->name_id = string_pool.intern(std::string_view(buffer, length));
+    thread_files->name_read_at_ns = now_ns;
+    return thread_files->name_id;
+}
+
+void ThreadProcFiles::retain_threads(const vector<uintptr_t>& tids) {
+    std::unordered_set<pid_t> alive(tids.begin(), tids.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = files.begin(); it != files.end();) {
+        if (alive.count(it->first) == 0) {
+            it = files.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "result.hpp"
+#include "stringpool.hpp"
+
+// What a thread was doing when it was sampled.
+struct ThreadState {
+    static const uint64_t NO_WCHAN = (uint64_t) -1;
+
+    // Field 3 of /proc/<tid>/stat: R (running), S (sleeping), D (disk sleep), ...
+    char run_state = '?';
+    // Number of the syscall the thread was in, -1 if it was in user code.
+    int64_t syscall = -1;
+    // Interned /proc/<tid>/wchan, i.e. the kernel function the thread sleeps in.
+    uint64_t wchan_id = NO_WCHAN;
+    // Parked in sigsuspend, which is how Mono suspends threads for the GC.
+    bool gc_suspended = false;
+
+    // Suffix of the perf-script event name: "running", "blocked" or "gc".
+    const char* category() const {
+        if (gc_suspended) {
+            return "gc";
+        }
+        return run_state == 'R' ? "running" : "blocked";
+    }
+};
+
+// Scheduler counters from /proc/<tid>/schedstat. If neither changed, the
+// thread has not been on a CPU in between, so its stack is the same too.
+struct SchedStat {
+    uint64_t run_time_ns = 0;
+    // Number of times the thread was scheduled in.
+    uint64_t timeslices = 0;
+
+    bool operator==(const SchedStat& other) const {
+        return run_time_ns == other.run_time_ns && timeslices == other.timeslices;
+    }
+};
+
+// Live list of the threads of a process. /proc/<pid>/task is only read
+// again (with getdents64() on a descriptor that stays open) when its link
+// count, which procfs keeps at 2 + the number of threads, has changed, after
+// invalidate(), or every RESCAN_INTERVAL_NS: a thread that exits while
+// another one starts leaves the count as it was. Otherwise refresh() is a
+// single fstat().
+class ThreadLister {
+public:
+    static const uint64_t RESCAN_INTERVAL_NS = 1000000000;
+
+    explicit ThreadLister(pid_t pid);
+    ThreadLister(const ThreadLister&) = delete;
+    ~ThreadLister();
+
+    // Returns true if tids() has changed. A process that is gone has no threads.
+    Result<bool, std::string> refresh();
+    // Makes the next refresh() rescan, e.g. after a listed thread turned out to be gone.
+    void invalidate() { stale = true; }
+
+    const std::vector<uintptr_t>& tids() const { return tids_; }
+    uint64_t rescans() const { return rescans_; }
+
+private:
+    pid_t pid;
+    int fd = -1;
+    std::vector<char> buffer;
+    std::vector<uintptr_t> tids_;
+    std::vector<uintptr_t> scanned;
+    nlink_t link_count = 0;
+    bool stale = true;
+    uint64_t scanned_at_ns = 0;
+    uint64_t rescans_ = 0;
+
+    Result<bool, std::string> scan();
+};
+
+// Keeps /proc/<pid>/task/<tid>/{stat,wchan,comm,schedstat} open for every sampled
+// thread and reads them with pread(), instead of opening them every tick.
+class ThreadProcFiles {
+public:
+    static const uint64_t NAME_REFRESH_NS = 1000000000;
+
+    explicit ThreadProcFiles(pid_t pid);
+    ThreadProcFiles(const ThreadProcFiles&) = delete;
+
+    // Must be called before the thread is stopped: afterwards stat and wchan
+    // would only show the ptrace stop.
+    bool read_state(pid_t tid, StringPool& string_pool, ThreadState& state);
+    // Fails if the kernel has no CONFIG_SCHED_INFO.
+    bool read_schedstat(pid_t tid, SchedStat& schedstat);
+    // Interned comm, with spaces replaced by '_' to keep perf-script
+    // parseable; an empty name if it cannot be read. Names rarely change,
+    // so the file is only read again after NAME_REFRESH_NS.
+    uint64_t read_name(pid_t tid, StringPool& string_pool);
+    // Closes files of threads that are not in `tids` anymore.
+    void retain_threads(const std::vector<uintptr_t>& tids);
+
+private:
+    struct Files {
+        int stat_fd = -1;
+        int wchan_fd = -1;
+        int comm_fd = -1;
+        int schedstat_fd = -1;
+        // Cached result of read_name().
+        bool has_name = false;
+        uint64_t name_id = 0;
+        uint64_t name_read_at_ns = 0;
+
+        Files() = default;
+        Files(const Files&) = delete;
+        ~Files();
+    };
+
+    pid_t pid;
+    std::mutex mutex;
+    std::unordered_map<pid_t, std::unique_ptr<Files>> files;
+
+    Files* get(pid_t tid);
+    ssize_t read_file(int& fd, pid_t tid, const char* name, char* buffer, size_t size);
+};
@@ -0,0 +1,121 @@
+#include <string>
+#include <utility>
+#include <unordered_set>
+
+#include <libunwind.h>
+
+#include "unwind_registry.hpp"
+
+using std::string;
+using std::move;
+using std::vector;
+
+UnwindRegistry::UnwindRegistry(pid_t pid) : pid(pid), maps_(pid) {
+    address_space_ = unw_create_addr_space(&vm_accessors, 0);
+    if (address_space_ != nullptr) {
+        // Each sampling thread gets its own cache, so workers never contend on it.
+        unw_set_caching_policy(address_space_, UNW_CACHE_PER_THREAD);
+    }
+}
+
+UnwindRegistry::~UnwindRegistry() {
+    contexts.clear();
+    if (address_space_ != nullptr) {
+        unw_destroy_addr_space(address_space_);
+        address_space_ = nullptr;
+    }
+}
+
+Result<bool, string> UnwindRegistry::refresh(vector<MemoryMapping>& removed) {
+    if (address_space_ == nullptr) {
+        return ResultInit::err(string("unw_create_addr_space() failed"));
+    }
+
+    removed.clear();
+    auto refresh_result = maps_.refresh(removed);
+    if (!refresh_result.isOk()) {
+        return refresh_result;
+    }
+
+    // Anonymous and data mappings come and go all the time in a live Mono
+    // process (heap, JIT arenas); they only need the cached unwind info of
+    // their own range dropped.
+    bool code_changed = false;
+    bool file_code_removed = false;
+    for (const auto& mapping: removed) {
+        if (!mapping.executable) {
+            continue;
+        }
+        unw_flush_cache(address_space_, mapping.start, mapping.end);
+        code_changed = true;
+        file_code_removed = file_code_removed || mapping.inode != 0;
+    }
+    if (code_changed) {
+        ++cache_flushes_;
+    }
+
+    if (file_code_removed) {
+        // UPT_info caches the last ELF image it looked at, which may be one
+        // of the unmapped files; recreate contexts lazily.
+        std::lock_guard<std::mutex> lock(contexts_mutex);
+        for (const auto& entry: contexts) {
+            retire(*entry.second);
+        }
+        contexts.clear();
+    }
+
+    return refresh_result;
+}
+
+VmUnwindContext* UnwindRegistry::context(pid_t tid) {
+    std::lock_guard<std::mutex> lock(contexts_mutex);
+    auto it = contexts.find(tid);
+    if (it != contexts.end()) {
+        return it->second.get();
+    }
+
+    auto context = std::make_unique<VmUnwindContext>(tid);
+    if (context->upt == nullptr) {
+        return nullptr;
+    }
+
+    VmUnwindContext* result = context.get();
+    contexts.emplace(tid, move(context));
+    return result;
+}
+
+void UnwindRegistry::retain_threads(const vector<uintptr_t>& tids) {
+    std::lock_guard<std::mutex> lock(contexts_mutex);
+    std::unordered_set<pid_t> alive(tids.begin(), tids.end());
+    for (auto it = contexts.begin(); it != contexts.end();) {
+        if (alive.count(it->first) == 0) {
+            retire(*it->second);
+            it = contexts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+uint64_t UnwindRegistry::proc_info_lookups() const {
+    std::lock_guard<std::mutex> lock(contexts_mutex);
+    uint64_t result = retired_proc_info_lookups;
+    for (const auto& entry: contexts) {
+        result += entry.second->proc_info_lookups;
+    }
+    return result;
+}
+
+uint64_t UnwindRegistry::spliced_frames() const {
+    std::lock_guard<std::mutex> lock(contexts_mutex);
+    uint64_t result = retired_spliced_frames;
+    for (const auto& entry: contexts) {
+        result += entry.second->stack_cache.spliced_frames();
+    }
+    return result;
+}
+
+void UnwindRegistry::retire(const VmUnwindContext& context) {
+    retired_proc_info_lookups += context.proc_info_lookups;
+    retired_spliced_frames += context.stack_cache.spliced_frames();
+}
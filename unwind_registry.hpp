@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include <libunwind.h>
+#include <sys/types.h>
+
+#include "result.hpp"
+#include "proc_maps.hpp"
+#include "vm_accessors.hpp"
+
+// Unwind state that lives for the whole profiling session: one libunwind
+// address space per process (so its proc-info and CFI caches survive between
+// samples) and one VmUnwindContext (with its UPT_info) per thread.
+//
+// Caches are flushed only for the address ranges of executable mappings that
+// changed in /proc/<pid>/maps; thread contexts are only recreated when an
+// executable file is unmapped.
+class UnwindRegistry {
+public:
+    explicit UnwindRegistry(pid_t pid);
+    UnwindRegistry(const UnwindRegistry&) = delete;
+    ~UnwindRegistry();
+
+    // Call once per tick, before sampling threads. `removed` receives all the
+    // mappings that disappeared or changed, for other per-address caches.
+    Result<bool, std::string> refresh(std::vector<MemoryMapping>& removed);
+
+    unw_addr_space_t address_space() const { return address_space_; }
+    // Safe to call from several sampling workers at once.
+    VmUnwindContext* context(pid_t tid);
+    // Drops contexts of threads that are not in `tids` anymore.
+    void retain_threads(const std::vector<uintptr_t>& tids);
+
+    const ProcMapsWatcher& maps() const { return maps_; }
+    uint64_t cache_flushes() const { return cache_flushes_; }
+    // Number of times libunwind had to look up unwind info, i.e. cache misses.
+    uint64_t proc_info_lookups() const;
+    // Frames reused from StackSuffixCache instead of being unwound.
+    uint64_t spliced_frames() const;
+
+private:
+    pid_t pid;
+    unw_addr_space_t address_space_ = nullptr;
+    ProcMapsWatcher maps_;
+    mutable std::mutex contexts_mutex;
+    std::unordered_map<pid_t, std::unique_ptr<VmUnwindContext>> contexts;
+    uint64_t cache_flushes_ = 0;
+    uint64_t retired_proc_info_lookups = 0;
+    uint64_t retired_spliced_frames = 0;
+
+    void retire(const VmUnwindContext& context);
+};
@@ -0,0 +1,176 @@
+#include <string>
+#include <utility>
+
+#include <libunwind.h>
+#include <libunwind-ptrace.h>
+#include <errno.h>
+#include <string.h>
+
+#include <sys/ptrace.h>
+
+#include "vm_accessors.hpp"
+
+using std::string;
+using std::to_string;
+
+VmUnwindContext::VmUnwindContext(pid_t tid) : tid(tid), memory(tid) {
+    upt = (struct UPT_info*) _UPT_create(tid);
+    memset(&regs, 0, sizeof(regs));
+}
+
+VmUnwindContext::~VmUnwindContext() {
+    if (upt) {
+        _UPT_destroy(upt);
+        upt = nullptr;
+    }
+}
+
+Result<bool, string> VmUnwindContext::load_registers() {
+    memory.reset(tid);
+    int rc = ptrace(PTRACE_GETREGS, tid, 0, &regs);
+    if (rc != 0) {
+        return ResultInit::err(string("ptrace(PTRACE_GETREGS) failed with errno = ") + to_string(errno) + " message = " + strerror(errno));
+    }
+
+    return ResultInit::ok(true);
+}
+
+void VmUnwindContext::load_captured_registers(uint64_t ip, uint64_t sp, uint64_t bp) {
+    memory.reset(tid);
+    memset(&regs, 0, sizeof(regs));
+    regs.rip = ip;
+    regs.rsp = sp;
+    regs.rbp = bp;
+    // Not in a syscall as far as the sample is concerned.
+    regs.orig_rax = (unsigned long long) -1;
+}
+
+// _UPT_find_proc_info() passes its `arg` (the UPT_info) back into our
+// access_mem() while it bisects remote unwind tables. Remember which context
+// is delegating so those reads still go through the page cache.
+static thread_local VmUnwindContext* delegating_context = nullptr;
+
+class DelegationScope {
+    VmUnwindContext* previous;
+public:
+    DelegationScope(VmUnwindContext* context) : previous(delegating_context) {
+        delegating_context = context;
+    }
+    DelegationScope(const DelegationScope&) = delete;
+    ~DelegationScope() {
+        delegating_context = previous;
+    }
+};
+
+static VmUnwindContext* context_from_arg(void* arg) {
+    if (delegating_context != nullptr && arg == delegating_context->upt) {
+        return delegating_context;
+    }
+
+    return static_cast<VmUnwindContext*>(arg);
+}
+
+static unsigned long long* register_slot(struct user_regs_struct& regs, unw_regnum_t regnum) {
+    switch (regnum) {
+        case UNW_X86_64_RAX: return &regs.rax;
+        case UNW_X86_64_RDX: return &regs.rdx;
+        case UNW_X86_64_RCX: return &regs.rcx;
+        case UNW_X86_64_RBX: return &regs.rbx;
+        case UNW_X86_64_RSI: return &regs.rsi;
+        case UNW_X86_64_RDI: return &regs.rdi;
+        case UNW_X86_64_RBP: return &regs.rbp;
+        case UNW_X86_64_RSP: return &regs.rsp;
+        case UNW_X86_64_R8: return &regs.r8;
+        case UNW_X86_64_R9: return &regs.r9;
+        case UNW_X86_64_R10: return &regs.r10;
+        case UNW_X86_64_R11: return &regs.r11;
+        case UNW_X86_64_R12: return &regs.r12;
+        case UNW_X86_64_R13: return &regs.r13;
+        case UNW_X86_64_R14: return &regs.r14;
+        case UNW_X86_64_R15: return &regs.r15;
+        case UNW_X86_64_RIP: return &regs.rip;
+        default: return nullptr;
+    }
+}
+
+static int vm_find_proc_info(unw_addr_space_t as, unw_word_t ip, unw_proc_info_t* pi, int need_unwind_info, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    ++context->proc_info_lookups;
+    DelegationScope scope(context);
+    return _UPT_find_proc_info(as, ip, pi, need_unwind_info, context->upt);
+}
+
+static void vm_put_unwind_info(unw_addr_space_t as, unw_proc_info_t* pi, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    _UPT_put_unwind_info(as, pi, context->upt);
+}
+
+static int vm_get_dyn_info_list_addr(unw_addr_space_t as, unw_word_t* dil_addr, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    DelegationScope scope(context);
+    return _UPT_get_dyn_info_list_addr(as, dil_addr, context->upt);
+}
+
+static int vm_access_mem(unw_addr_space_t, unw_word_t addr, unw_word_t* val, int write, void* arg) {
+    if (write) {
+        // unwinding never writes to the target
+        return -UNW_EINVAL;
+    }
+
+    VmUnwindContext* context = context_from_arg(arg);
+    uint64_t value;
+    if (!context->memory.read_word(addr, value)) {
+        return -UNW_EINVAL;
+    }
+
+    *val = value;
+    return 0;
+}
+
+static int vm_access_reg(unw_addr_space_t, unw_regnum_t regnum, unw_word_t* val, int write, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    unsigned long long* slot = register_slot(context->regs, regnum);
+    if (slot == nullptr) {
+        return -UNW_EBADREG;
+    }
+
+    if (write) {
+        *slot = *val;
+    } else {
+        *val = *slot;
+    }
+    return 0;
+}
+
+static int vm_access_fpreg(unw_addr_space_t as, unw_regnum_t regnum, unw_fpreg_t* val, int write, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    return _UPT_access_fpreg(as, regnum, val, write, context->upt);
+}
+
+static int vm_resume(unw_addr_space_t as, unw_cursor_t* cursor, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    return _UPT_resume(as, cursor, context->upt);
+}
+
+static int vm_get_proc_name(unw_addr_space_t as, unw_word_t ip, char* buf, size_t buf_len, unw_word_t* offp, void* arg) {
+    VmUnwindContext* context = context_from_arg(arg);
+    DelegationScope scope(context);
+    return _UPT_get_proc_name(as, ip, buf, buf_len, offp, context->upt);
+}
+
+static unw_accessors_t make_vm_accessors() {
+    // Field-by-field, as newer libunwind versions append members to the struct.
+    unw_accessors_t accessors;
+    memset(&accessors, 0, sizeof(accessors));
+    accessors.find_proc_info = vm_find_proc_info;
+    accessors.put_unwind_info = vm_put_unwind_info;
+    accessors.get_dyn_info_list_addr = vm_get_dyn_info_list_addr;
+    accessors.access_mem = vm_access_mem;
+    accessors.access_reg = vm_access_reg;
+    accessors.access_fpreg = vm_access_fpreg;
+    accessors.resume = vm_resume;
+    accessors.get_proc_name = vm_get_proc_name;
+    return accessors;
+}
+
+unw_accessors_t vm_accessors = make_vm_accessors();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <libunwind.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include "result.hpp"
+#include "remote_memory.hpp"
+#include "stack_cache.hpp"
+
+// libunwind accessors that read target memory through RemoteMemory and
+// registers through a single PTRACE_GETREGS, instead of one
+// PTRACE_PEEKTEXT/PEEKUSER per word as _UPT_accessors does.
+//
+// ELF-level work (unwind table lookup, proc names) is still delegated to
+// libunwind-ptrace, so a VmUnwindContext owns an UPT_info as well.
+struct VmUnwindContext {
+    pid_t tid;
+    struct UPT_info* upt;
+    RemoteMemory memory;
+    struct user_regs_struct regs;
+    uint64_t proc_info_lookups = 0;
+    // Previous stack of this thread, for incremental unwinding.
+    StackSuffixCache stack_cache;
+    // Scratch list of return addresses, reused by every unwind of this thread.
+    std::vector<uintptr_t> ips;
+
+    explicit VmUnwindContext(pid_t tid);
+    VmUnwindContext(const VmUnwindContext&) = delete;
+    ~VmUnwindContext();
+
+    // Must be called while the thread is ptrace-stopped, before unw_init_remote().
+    Result<bool, std::string> load_registers();
+    // Registers sampled by the kernel (perf engine) for a thread that is not
+    // stopped; the caller then attaches the captured stack to `memory`.
+    void load_captured_registers(uint64_t ip, uint64_t sp, uint64_t bp);
+};
+
+extern unw_accessors_t vm_accessors;
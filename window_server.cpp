@@ -0,0 +1,185 @@
+#include <string>
+#include <utility>
+#include <algorithm>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "window_server.hpp"
+
+using std::string;
+using std::to_string;
+using std::vector;
+using std::move;
+
+// Limits the time a client that never sends its request can hold the server.
+static const int REQUEST_TIMEOUT_SECONDS = 1;
+static const size_t MAX_REQUEST_LENGTH = 256;
+
+static string errno_message(const string& call) {
+    int errno_copy = errno;
+    return call + " failed: errno = " + to_string(errno_copy) + " message = " + strerror(errno_copy);
+}
+
+Result<std::unique_ptr<WindowServer>, string> WindowServer::start(const string& path, ProfileWindows& windows) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return ResultInit::err("socket path is too long: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return ResultInit::err(errno_message("socket(AF_UNIX)"));
+    }
+    // Left behind by a previous run that was killed. Anything but a socket
+    // is left alone, and bind() then fails with EADDRINUSE. So is the socket
+    // of a daemon that is still running: two of them would write and rotate
+    // the same windows.
+    struct stat path_stat;
+    if (lstat(path.c_str(), &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+        int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool in_use = probe_fd >= 0 && connect(probe_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe_fd >= 0) {
+            close(probe_fd);
+        }
+        if (in_use) {
+            close(fd);
+            return ResultInit::err("another mono_ssp is already serving " + path);
+        }
+        unlink(path.c_str());
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) {
+        string message = errno_message("bind(" + path + ")");
+        close(fd);
+        return ResultInit::err(move(message));
+    }
+    if (listen(fd, 16) != 0) {
+        string message = errno_message("listen(" + path + ")");
+        close(fd);
+        unlink(path.c_str());
+        return ResultInit::err(move(message));
+    }
+
+    int stop_fds[2];
+    if (pipe2(stop_fds, O_CLOEXEC) != 0) {
+        string message = errno_message("pipe2()");
+        close(fd);
+        unlink(path.c_str());
+        return ResultInit::err(move(message));
+    }
+
+    return ResultInit::ok(std::unique_ptr<WindowServer>(new WindowServer(path, windows, fd, stop_fds[0], stop_fds[1])));
+}
+
+WindowServer::WindowServer(string path, ProfileWindows& windows, int listen_fd, int stop_read_fd, int stop_write_fd)
+    : path(std::move(path)), windows(windows), listen_fd(listen_fd), stop_pipe { stop_read_fd, stop_write_fd } {
+    thread = std::thread(&WindowServer::run, this);
+}
+
+WindowServer::~WindowServer() {
+    char byte = 0;
+    while (write(stop_pipe[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+    thread.join();
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+void WindowServer::run() {
+    while (true) {
+        struct pollfd fds[2] = {
+            { listen_fd, POLLIN, 0 },
+            { stop_pipe[0], POLLIN, 0 },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+void WindowServer::serve(int fd) {
+    struct timeval timeout { REQUEST_TIMEOUT_SECONDS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    string request;
+    char buffer[MAX_REQUEST_LENGTH];
+    while (request.find('\n') == string::npos && request.size() < MAX_REQUEST_LENGTH) {
+        ssize_t rc = read(fd, buffer, sizeof(buffer));
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            break;
+        }
+        request.append(buffer, rc);
+    }
+    request = request.substr(0, request.find('\n'));
+
+    OutputBuffer out;
+    if (request == "list") {
+        for (const auto& name: windows.windows()) {
+            out.append(name).append('\n');
+        }
+        out.append("current\n");
+    } else if (request == "current") {
+        windows.current(out);
+    } else if (request.rfind("window ", 0) == 0) {
+        string name = request.substr(strlen("window "));
+        vector<string> names = windows.windows();
+        if (std::find(names.begin(), names.end(), name) == names.end()) {
+            out.append("error: no window ").append(name).append('\n');
+        } else {
+            int file_fd = open((windows.directory() + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+            if (file_fd < 0) {
+                // Rotated away in the meantime.
+                out.append("error: no window ").append(name).append('\n');
+            } else {
+                char file_buffer[1 << 16];
+                ssize_t rc;
+                while ((rc = read(file_fd, file_buffer, sizeof(file_buffer))) != 0) {
+                    if (rc < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        break;
+                    }
+                    out.append(std::string_view(file_buffer, rc));
+                }
+                close(file_fd);
+            }
+        }
+    } else {
+        out.append("error: unknown request, expected list, current or window NAME\n");
+    }
+    out.flush_to(fd);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <thread>
+
+#include "result.hpp"
+#include "profile_windows.hpp"
+
+// Serves ProfileWindows over a local Unix socket, one request per
+// connection. The client sends a single line:
+//   list         names of the stored windows, oldest first, then "current"
+//   current      folded stacks of the window in progress
+//   window NAME  a stored window, as written to the directory
+// e.g. `echo current | socat - UNIX-CONNECT:PATH`. Errors are answered
+// with a line starting with "error: ".
+class WindowServer {
+public:
+    static Result<std::unique_ptr<WindowServer>, std::string> start(const std::string& path, ProfileWindows& windows);
+
+    WindowServer(const WindowServer&) = delete;
+    // Stops the server thread and removes the socket.
+    ~WindowServer();
+
+private:
+    std::string path;
+    ProfileWindows& windows;
+    int listen_fd;
+    // Written to by the destructor to wake the server thread up.
+    int stop_pipe[2];
+    std::thread thread;
+
+    WindowServer(std::string path, ProfileWindows& windows, int listen_fd, int stop_read_fd, int stop_write_fd);
+    void run();
+    void serve(int fd);
+};
@@ -0,0 +1,60 @@
+#include "worker_pool.hpp"
+
+WorkerPool::WorkerPool(size_t workers) : workers(workers == 0 ? 1 : workers) {
+    if (this->workers > 1) {
+        for (size_t i = 0; i < this->workers; ++i) {
+            threads.emplace_back(&WorkerPool::worker_loop, this, i);
+        }
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start_cv.notify_all();
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::run(FunctionRef<void(size_t)> fn) {
+    if (threads.empty()) {
+        fn(0);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &fn;
+    pending = threads.size();
+    ++generation;
+    start_cv.notify_all();
+    done_cv.wait(lock, [this] { return pending == 0; });
+    task = nullptr;
+}
+
+void WorkerPool::worker_loop(size_t index) {
+    uint64_t seen_generation = 0;
+    while (true) {
+        const FunctionRef<void(size_t)>* current_task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_cv.wait(lock, [&] { return stopping || generation != seen_generation; });
+            if (stopping) {
+                return;
+            }
+            seen_generation = generation;
+            current_task = task;
+        }
+
+        (*current_task)(index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0) {
+                done_cv.notify_one();
+            }
+        }
+    }
+}
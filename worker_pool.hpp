@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "function_ref.hpp"
+
+// Fixed set of threads that run one batch per call to run(). Threads are
+// kept for the whole session, so a tick does not pay for thread creation.
+//
+// A ptrace tracee belongs to the tracer *thread*, so callers must make sure
+// that every stop/wait/detach of a tracee happens within one worker.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t workers);
+    WorkerPool(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    size_t size() const { return workers; }
+
+    // Calls fn(worker_index) once on every worker and waits for all of them.
+    // With a single worker fn is called on the calling thread.
+    void run(FunctionRef<void(size_t)> fn);
+
+private:
+    size_t workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const FunctionRef<void(size_t)>* task = nullptr;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool stopping = false;
+
+    void worker_loop(size_t index);
+};